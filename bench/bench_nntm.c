@@ -0,0 +1,259 @@
+/* bench_nntm – microbenchmarks for the nntm viewer internals
+ *
+ * Compiles nntm.c into this translation unit (its main() renamed) so the
+ * static parser, sort, grouping, filter and draw routines can be timed
+ * directly. Every benchmark prints one JSON object per line on stdout.
+ *
+ *   bench_nntm [-r <reps>] [-f <filter>]
+ */
+#define main nntm_main
+#include "../src/nntm.c"
+#undef main
+
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+
+#define BENCH_TYPES 8
+
+static int reps         = 7;
+static const char *only = NULL;
+
+/* ───────────────────────── helpers ───────────────────────── */
+
+static uint64_t now_ns( void )
+{
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64 – fixed seed so every run sees the same input */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+static uint64_t rng( void )
+{
+      rng_state ^= rng_state << 13;
+      rng_state ^= rng_state >> 7;
+      rng_state ^= rng_state << 17;
+      return rng_state;
+}
+
+static int cmp_u64( const void *a, const void *b )
+{
+      uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+      return x < y ? -1 : x > y;
+}
+
+/* Runs fn() `iters` times per repetition; setup() (untimed) before each
+ * call. Reports median and best ns per op, `ops` being work items per call. */
+static void run( const char *name, int iters, long ops, void ( *setup )( void ),
+                 void ( *fn )( void ) )
+{
+      if ( only && !strstr( name, only ) )
+            return;
+
+      uint64_t per_rep[ 64 ];
+      int n = reps < 64 ? reps : 64;
+
+      for ( int r = -1; r < n; ++r ) /* r == -1 is the warm-up pass */
+      {
+            uint64_t total = 0;
+            for ( int i = 0; i < iters; ++i )
+            {
+                  if ( setup )
+                        setup();
+                  uint64_t t0 = now_ns();
+                  fn();
+                  total += now_ns() - t0;
+            }
+            if ( r >= 0 )
+                  per_rep[ r ] = total;
+      }
+
+      qsort( per_rep, n, sizeof per_rep[ 0 ], cmp_u64 );
+      double div    = (double)iters * (double)ops;
+      double median = per_rep[ n / 2 ] / div;
+      double best   = per_rep[ 0 ] / div;
+
+      printf( "{\"bench\":\"%s\",\"rev\":\"%s\",\"reps\":%d,\"iters\":%d,"
+              "\"ops\":%ld,\"ns_per_op\":%.1f,\"best_ns_per_op\":%.1f,"
+              "\"ops_per_sec\":%.0f}\n",
+              name, BENCH_REV, n, iters, ops, median, best,
+              median > 0 ? 1e9 / median : 0.0 );
+      fflush( stdout );
+}
+
+/* ─────────────────────── fixtures ────────────────────────── */
+
+static char fixture_path[] = "/tmp/nntm-bench-XXXXXX";
+static Todo snapshot[ MAX_TODOS ];
+static int snapshot_count = 0;
+
+/* Writes MAX_TODOS lines mixing every format load_todos understands. */
+static void write_fixture( void )
+{
+      int fd = mkstemp( fixture_path );
+      if ( fd == -1 )
+      {
+            perror( "mkstemp" );
+            exit( 1 );
+      }
+      FILE *f = fdopen( fd, "w" );
+
+      for ( int i = 0; i < MAX_TODOS; ++i )
+      {
+            int day  = 1 + (int)( rng() % 28 );
+            int mon  = 1 + (int)( rng() % 12 );
+            char pri = 'A' + (char)( rng() % 6 );
+            int type = (int)( rng() % BENCH_TYPES );
+
+            switch ( rng() % 4 )
+            {
+            case 0:
+                  fprintf( f, "(%c) 2025-%02d-%02d @type%d task %d with text\n",
+                           pri, mon, day, type, i );
+                  break;
+            case 1:
+                  fprintf( f, "2025-%02d-%02d @type%d plain entry %d\n", mon,
+                           day, type, i );
+                  break;
+            case 2:
+                  fprintf( f,
+                           "x 2025-%02d-%02d 2025-01-01 @type%d done %d "
+                           "pri:%c\n",
+                           mon, day, type, i, pri );
+                  break;
+            default:
+                  fprintf( f, "2025-%02d-%02d untyped line number %d\n", mon,
+                           day, i );
+                  break;
+            }
+      }
+      fclose( f );
+}
+
+static void restore_snapshot( void )
+{
+      memcpy( todos, snapshot, sizeof( Todo ) * snapshot_count );
+      todo_count = snapshot_count;
+}
+
+/* ─────────────────────── benchmarks ──────────────────────── */
+
+static void b_parse( void )
+{
+      load_todos( fixture_path );
+}
+
+static void b_sort_priority( void )
+{
+      sort_todos_by_priority( false );
+}
+
+static void b_sort_date( void )
+{
+      sort_todos_by_date( true );
+}
+
+static void b_group( void )
+{
+      group_todos_by_completed();
+}
+
+static void b_filter( void )
+{
+      volatile int sink = 0;
+      for ( int i = 0; i < type_count; ++i )
+            sink += count_visible_items_for_type( types[ i ] );
+      (void)sink;
+}
+
+static int frame = 0;
+static void b_draw( void )
+{
+      /* move the selection so every frame has something to repaint */
+      selected_index = frame++ % 40;
+      draw_ui();
+}
+
+static void select_type( const char *name )
+{
+      for ( int i = 0; i < type_count; ++i )
+            if ( !strcmp( types[ i ], name ) )
+                  selected_type = i;
+}
+
+/* ─────────────────────────── main ────────────────────────── */
+
+int main( int argc, char **argv )
+{
+      for ( int i = 1; i < argc; ++i )
+            if ( !strcmp( argv[ i ], "-r" ) && i + 1 < argc )
+                  reps = atoi( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-f" ) && i + 1 < argc )
+                  only = argv[ ++i ];
+            else
+            {
+                  fprintf( stderr, "usage: %s [-r <reps>] [-f <filter>]\n",
+                           argv[ 0 ] );
+                  return 1;
+            }
+      if ( reps < 1 )
+            reps = 1;
+
+      write_fixture();
+      load_todos( fixture_path );
+      memcpy( snapshot, todos, sizeof( Todo ) * todo_count );
+      snapshot_count = todo_count;
+
+      run( "parse_load_todos", 50, MAX_TODOS, NULL, b_parse );
+      restore_snapshot();
+
+      selected_type = 0; /* @all */
+      run( "sort_priority_all", 200, snapshot_count, restore_snapshot,
+           b_sort_priority );
+      run( "sort_date_all", 200, snapshot_count, restore_snapshot,
+           b_sort_date );
+      run( "group_completed_all", 200, snapshot_count, restore_snapshot,
+           b_group );
+
+      select_type( "type3" );
+      run( "sort_priority_type", 200, snapshot_count, restore_snapshot,
+           b_sort_priority );
+      run( "group_completed_type", 200, snapshot_count, restore_snapshot,
+           b_group );
+
+      restore_snapshot();
+      run( "filter_count_visible", 500, (long)type_count * snapshot_count,
+           NULL, b_filter );
+
+      /* headless ncurses screen: all terminal output goes to /dev/null */
+      FILE *out = fopen( "/dev/null", "w" );
+      FILE *in  = fopen( "/dev/null", "r" );
+      SCREEN *scr =
+          out && in ? newterm( getenv( "TERM" ) ? NULL : "xterm-256color", out,
+                               in )
+                    : NULL;
+      if ( scr )
+      {
+            set_term( scr );
+            resizeterm( 50, 160 );
+            start_color();
+            use_default_colors();
+
+            auto_scroll_enabled = false;
+            selected_type       = 0;
+            scroll_offset       = 0;
+            run( "draw_ui_all", 300, 1, NULL, b_draw );
+            select_type( "type3" );
+            run( "draw_ui_type", 300, 1, NULL, b_draw );
+
+            endwin();
+            delscreen( scr );
+      }
+      else
+            fprintf( stderr, "newterm failed, skipping draw_ui\n" );
+
+      unlink( fixture_path );
+      return 0;
+}
@@ -0,0 +1,535 @@
+/* bench_nntmd – end-to-end benchmark for the nntmd multiplexer
+ *
+ * Starts a private nntmd, connects M readers and N synthetic writers and
+ * pushes lines of the form "@bench<w> <seq> <send-ns> <pad>" through it.
+ * Readers stamp arrival times; the result is one JSON object on stdout with
+ * throughput, latency percentiles, dropped/garbled line counts and the CPU
+ * time the daemon burned.
+ *
+ *   bench_nntmd -d <nntmd> [-w writers] [-r readers] [-n lines/writer]
+ *               [-s line-size] [-b lines/write] [-R lines/s/writer]
+ *               [-H nntm] [-l label] [-P] [-A] [-- extra nntmd args]
+ *
+ * With -H every reader is an `nntm --headless` process instead of a raw
+ * socket, so the numbers include the viewer's own ingest path. With -P
+ * writers use the daemon's SOCK_SEQPACKET socket (-S), sending each line
+ * as a message without its newline, a batch per sendmmsg. With -A they
+ * hand each line to the nntm_send library instead (-b is then moot: it
+ * batches by itself), and send_ns_per_line is what that call costs.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/nntm_send.h"
+
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+
+#define MAX_PEERS 1024
+#define LINE_MAX_LEN 4096
+#define IDLE_TIMEOUT_MS 2000
+
+typedef struct
+{
+      pthread_t th;
+      int fd;
+      int id;
+      pid_t pid; /* headless viewer process, if any */
+      /* reader results */
+      uint64_t lines;
+      uint64_t bytes;
+      uint64_t garbled;
+      uint64_t *lat;    /* ns, one per received line */
+      uint64_t last_ns; /* arrival of the last line */
+      /* writer results */
+      uint64_t send_ns; /* in write()/sendmmsg()/nntm_send_line() */
+      NntmSend *sender; /* -A */
+} Peer;
+
+static const char *daemon_bin = NULL;
+static char sock_path[ 108 ];
+static char pkt_path[ 112 ];
+static bool packets       = false;
+static bool use_lib       = false; /* -A */
+static int n_writers      = 1;
+static int n_readers      = 1;
+static long lines_per_w   = 100000;
+static int line_size      = 64;
+static int lines_per_wr   = 1;
+static long rate          = 0; /* lines/s per writer, 0 = unthrottled */
+static const char *label  = "";
+static const char *viewer = NULL; /* nntm binary for -H */
+static char **daemon_args = NULL;
+static int n_daemon_args  = 0;
+
+static Peer writers[ MAX_PEERS ];
+static Peer readers[ MAX_PEERS ];
+static uint64_t expected = 0;
+static uint64_t t_start  = 0;
+static pthread_barrier_t start_line;
+
+/* ───────────────────────── helpers ───────────────────────── */
+
+static uint64_t now_ns( void )
+{
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void die( const char *msg )
+{
+      perror( msg );
+      exit( 1 );
+}
+
+static int cmp_u64( const void *a, const void *b )
+{
+      uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+      return x < y ? -1 : x > y;
+}
+
+static int connect_to( const char *path, int type )
+{
+      int fd = socket( AF_UNIX, type, 0 );
+      if ( fd == -1 )
+            die( "socket" );
+
+      struct sockaddr_un sa = { .sun_family = AF_UNIX };
+      snprintf( sa.sun_path, sizeof sa.sun_path, "%s", path );
+      if ( connect( fd, (struct sockaddr *)&sa, sizeof sa ) == -1 )
+            die( "connect" );
+      return fd;
+}
+
+static int connect_as( const char *hello )
+{
+      int fd = connect_to( sock_path, SOCK_STREAM );
+
+      size_t len = strlen( hello );
+      if ( write( fd, hello, len ) != (ssize_t)len )
+            die( "handshake" );
+
+      /* consume the "OK...\n" acknowledgement byte by byte so no payload
+       * is swallowed with it */
+      char c;
+      while ( read( fd, &c, 1 ) == 1 && c != '\n' )
+            ;
+      return fd;
+}
+
+/* ───────────────────────── writers ───────────────────────── */
+
+static void *writer_main( void *arg )
+{
+      Peer *w   = arg;
+      char *buf = malloc( (size_t)lines_per_wr * LINE_MAX_LEN );
+      struct iovec *iov    = calloc( (size_t)lines_per_wr, sizeof *iov );
+      struct mmsghdr *msgs = calloc( (size_t)lines_per_wr, sizeof *msgs );
+      char pad[ LINE_MAX_LEN ];
+      memset( pad, 'x', sizeof pad );
+
+      pthread_barrier_wait( &start_line );
+
+      uint64_t interval = rate ? 1000000000ull / (uint64_t)rate : 0;
+      uint64_t next     = now_ns();
+
+      for ( long seq = 0; seq < lines_per_w; )
+      {
+            size_t len = 0;
+            int nmsgs  = 0;
+            for ( int k = 0; k < lines_per_wr && seq < lines_per_w; ++k )
+            {
+                  if ( interval )
+                  {
+                        struct timespec ts = {
+                            .tv_sec  = (time_t)( next / 1000000000ull ),
+                            .tv_nsec = (long)( next % 1000000000ull ) };
+                        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                                         NULL );
+                        next += interval;
+                  }
+                  int n = snprintf( buf + len, LINE_MAX_LEN,
+                                    "@bench%d %ld %llu ", w->id, seq++,
+                                    (unsigned long long)now_ns() );
+                  int pad_len = line_size - n - 1;
+                  if ( pad_len > 0 )
+                  {
+                        memcpy( buf + len + n, pad, (size_t)pad_len );
+                        n += pad_len;
+                  }
+                  buf[ len + n ] = '\n';
+                  iov[ k ]       = (struct iovec){ buf + len, (size_t)n };
+                  msgs[ k ]      = (struct mmsghdr){
+                      .msg_hdr = { .msg_iov = &iov[ k ], .msg_iovlen = 1 } };
+                  len += (size_t)n + 1;
+                  nmsgs = k + 1;
+            }
+
+            uint64_t t0 = now_ns();
+            for ( int k = 0; use_lib && k < nmsgs; ++k )
+                  nntm_send_line( w->sender, iov[ k ].iov_base,
+                                  iov[ k ].iov_len );
+            for ( int sent = 0; packets && sent < nmsgs; )
+            {
+                  int n = sendmmsg( w->fd, msgs + sent,
+                                    (unsigned)( nmsgs - sent ), 0 );
+                  if ( n <= 0 )
+                  {
+                        if ( n == -1 && errno == EINTR )
+                              continue;
+                        perror( "writer" );
+                        goto out;
+                  }
+                  sent += n;
+            }
+            for ( size_t off = 0; !packets && !use_lib && off < len; )
+            {
+                  ssize_t n = write( w->fd, buf + off, len - off );
+                  if ( n <= 0 )
+                  {
+                        if ( n == -1 && errno == EINTR )
+                              continue;
+                        perror( "writer" );
+                        goto out;
+                  }
+                  off += (size_t)n;
+            }
+            w->send_ns += now_ns() - t0;
+      }
+out:
+      if ( use_lib )
+            nntm_send_close( w->sender, IDLE_TIMEOUT_MS, NULL );
+      free( msgs );
+      free( iov );
+      free( buf );
+      return NULL;
+}
+
+/* ───────────────────────── readers ───────────────────────── */
+
+static void *reader_main( void *arg )
+{
+      Peer *r = arg;
+      char buf[ 65536 ];
+      char line[ LINE_MAX_LEN ];
+      size_t line_len = 0;
+
+      r->lat = malloc( sizeof( uint64_t ) * ( expected ? expected : 1 ) );
+
+      struct pollfd pfd = { .fd = r->fd, .events = POLLIN };
+
+      while ( r->lines + r->garbled < expected )
+      {
+            if ( poll( &pfd, 1, IDLE_TIMEOUT_MS ) <= 0 )
+                  break; /* idle timeout */
+
+            ssize_t n = read( r->fd, buf, sizeof buf );
+            if ( n <= 0 )
+                  break; /* EOF or error */
+
+            uint64_t t = now_ns();
+            r->bytes += (uint64_t)n;
+
+            for ( ssize_t i = 0; i < n; ++i )
+            {
+                  if ( buf[ i ] != '\n' )
+                  {
+                        if ( line_len < sizeof line - 1 )
+                              line[ line_len++ ] = buf[ i ];
+                        continue;
+                  }
+                  line[ line_len ] = '\0';
+                  line_len         = 0;
+
+                  /* nntmd -d numbers its lines: "<seq>\t<line>" */
+                  char *rec = line + strspn( line, "0123456789" );
+                  rec       = rec != line && *rec == '\t' ? rec + 1 : line;
+
+                  int id;
+                  long seq;
+                  unsigned long long sent;
+                  if ( sscanf( rec, "@bench%d %ld %llu", &id, &seq, &sent ) ==
+                           3 &&
+                       id >= 0 && id < n_writers && sent <= t &&
+                       r->lines < expected )
+                  {
+                        r->lat[ r->lines++ ] = t - sent;
+                        r->last_ns           = t;
+                  }
+                  else
+                        ++r->garbled;
+            }
+      }
+      return NULL;
+}
+
+/* ───────────────────────── daemon ────────────────────────── */
+
+static pid_t start_daemon( void )
+{
+      snprintf( sock_path, sizeof sock_path, "/tmp/nntm-bench-%d.sock",
+                (int)getpid() );
+      unlink( sock_path );
+      snprintf( pkt_path, sizeof pkt_path, "%s.pkt", sock_path );
+
+      pid_t pid = fork();
+      if ( pid == -1 )
+            die( "fork" );
+      if ( pid == 0 )
+      {
+            char **av = calloc( (size_t)n_daemon_args + 6, sizeof *av );
+            int ac    = 0;
+            av[ ac++ ] = (char *)daemon_bin;
+            av[ ac++ ] = "-p";
+            av[ ac++ ] = sock_path;
+            if ( packets )
+            {
+                  av[ ac++ ] = "-S";
+                  av[ ac++ ] = pkt_path;
+            }
+            for ( int i = 0; i < n_daemon_args; ++i )
+                  av[ ac++ ] = daemon_args[ i ];
+            execv( daemon_bin, av );
+            _exit( 127 );
+      }
+
+      /* wait for the socket to appear */
+      for ( int i = 0; i < 500; ++i )
+      {
+            struct stat st;
+            if ( stat( sock_path, &st ) == 0 && S_ISSOCK( st.st_mode ) &&
+                 ( !packets || stat( pkt_path, &st ) == 0 ) )
+                  return pid;
+            usleep( 10000 );
+      }
+      fprintf( stderr, "daemon did not come up on %s\n", sock_path );
+      kill( pid, SIGKILL );
+      exit( 1 );
+}
+
+/* Starts `nntm --headless` on the daemon socket; its stdout is the
+ * reader's fd. */
+static int spawn_viewer( Peer *r )
+{
+      int pfd[ 2 ];
+      if ( pipe( pfd ) == -1 )
+            die( "pipe" );
+
+      r->pid = fork();
+      if ( r->pid == -1 )
+            die( "fork" );
+      if ( r->pid == 0 )
+      {
+            dup2( pfd[ 1 ], STDOUT_FILENO );
+            close( pfd[ 0 ] );
+            close( pfd[ 1 ] );
+            execl( viewer, viewer, "--headless", sock_path, (char *)NULL );
+            _exit( 127 );
+      }
+      close( pfd[ 1 ] );
+      return pfd[ 0 ];
+}
+
+/* ─────────────────────────── main ────────────────────────── */
+
+static void usage( const char *argv0 )
+{
+      fprintf( stderr,
+               "usage: %s -d <nntmd> [-w writers] [-r readers] "
+               "[-n lines/writer] [-s line-size] [-b lines/write] "
+               "[-R lines/s/writer] [-H nntm] [-l label] [-P] [-A] "
+               "[-- nntmd args]\n",
+               argv0 );
+      exit( 1 );
+}
+
+int main( int argc, char **argv )
+{
+      for ( int i = 1; i < argc; ++i )
+      {
+            if ( !strcmp( argv[ i ], "--" ) )
+            {
+                  daemon_args   = argv + i + 1;
+                  n_daemon_args = argc - i - 1;
+                  break;
+            }
+            if ( !strcmp( argv[ i ], "-P" ) )
+            {
+                  packets = true;
+                  continue;
+            }
+            if ( !strcmp( argv[ i ], "-A" ) )
+            {
+                  use_lib = true;
+                  continue;
+            }
+            if ( i + 1 >= argc )
+                  usage( argv[ 0 ] );
+            if ( !strcmp( argv[ i ], "-d" ) )
+                  daemon_bin = argv[ ++i ];
+            else if ( !strcmp( argv[ i ], "-w" ) )
+                  n_writers = atoi( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-r" ) )
+                  n_readers = atoi( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-n" ) )
+                  lines_per_w = atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-s" ) )
+                  line_size = atoi( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-b" ) )
+                  lines_per_wr = atoi( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-R" ) )
+                  rate = atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-l" ) )
+                  label = argv[ ++i ];
+            else if ( !strcmp( argv[ i ], "-H" ) )
+                  viewer = argv[ ++i ];
+            else
+                  usage( argv[ 0 ] );
+      }
+      if ( !daemon_bin || n_writers < 1 || n_writers > MAX_PEERS ||
+           n_readers < 1 || n_readers > MAX_PEERS || lines_per_wr < 1 ||
+           line_size < 40 || line_size >= LINE_MAX_LEN )
+            usage( argv[ 0 ] );
+
+      signal( SIGPIPE, SIG_IGN );
+      expected   = (uint64_t)n_writers * (uint64_t)lines_per_w;
+      pid_t dpid = start_daemon();
+
+      for ( int i = 0; i < n_readers; ++i )
+      {
+            readers[ i ].id = i;
+            readers[ i ].fd = viewer ? spawn_viewer( &readers[ i ] )
+                                     : connect_as( "READER\n" );
+            pthread_create( &readers[ i ].th, NULL, reader_main, &readers[ i ] );
+      }
+      pthread_barrier_init( &start_line, NULL, (unsigned)n_writers + 1 );
+      for ( int i = 0; i < n_writers; ++i )
+      {
+            writers[ i ].id = i;
+            if ( use_lib )
+            {
+                  /* blocks rather than drops, as the raw writers do */
+                  NntmSendOptions opt = { .sock_path = sock_path,
+                                          .block     = true };
+                  if ( !( writers[ i ].sender = nntm_send_open( &opt ) ) )
+                        die( "nntm_send_open" );
+            }
+            else
+                  writers[ i ].fd = packets
+                                        ? connect_to( pkt_path, SOCK_SEQPACKET )
+                                        : connect_as( "WRITER\n" );
+            pthread_create( &writers[ i ].th, NULL, writer_main, &writers[ i ] );
+      }
+
+      /* let the daemon register everyone */
+      usleep( viewer ? 500000 : 100000 );
+      t_start = now_ns();
+      pthread_barrier_wait( &start_line );
+
+      for ( int i = 0; i < n_writers; ++i )
+            pthread_join( writers[ i ].th, NULL );
+      uint64_t t_sent = now_ns();
+      for ( int i = 0; i < n_readers; ++i )
+            pthread_join( readers[ i ].th, NULL );
+
+      for ( int i = 0; i < n_readers; ++i )
+            if ( readers[ i ].pid > 0 )
+            {
+                  kill( readers[ i ].pid, SIGKILL );
+                  waitpid( readers[ i ].pid, NULL, 0 );
+            }
+
+      /* write()/writev()/sendfile() calls the daemon made, from /proc */
+      unsigned long long syscw = 0;
+      char io_path[ 64 ], io[ 512 ];
+      snprintf( io_path, sizeof io_path, "/proc/%d/io", (int)dpid );
+      FILE *f = fopen( io_path, "r" );
+      if ( f )
+      {
+            size_t n = fread( io, 1, sizeof io - 1, f );
+            io[ n ]  = '\0';
+            char *p  = strstr( io, "syscw: " );
+            if ( p )
+                  syscw = strtoull( p + 7, NULL, 10 );
+            fclose( f );
+      }
+
+      /* stop the daemon and collect its CPU usage */
+      kill( dpid, SIGKILL );
+      struct rusage ru;
+      int status;
+      wait4( dpid, &status, 0, &ru );
+      unlink( sock_path );
+      unlink( pkt_path );
+      double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+                   ( ru.ru_utime.tv_usec + ru.ru_stime.tv_usec ) / 1e6;
+
+      /* aggregate */
+      uint64_t got = 0, bytes = 0, garbled = 0, t_last = t_sent, send_ns = 0;
+      for ( int i = 0; i < n_writers; ++i )
+            send_ns += writers[ i ].send_ns;
+      for ( int i = 0; i < n_readers; ++i )
+      {
+            got += readers[ i ].lines;
+            bytes += readers[ i ].bytes;
+            garbled += readers[ i ].garbled;
+            if ( readers[ i ].last_ns > t_last )
+                  t_last = readers[ i ].last_ns;
+      }
+
+      uint64_t *all = malloc( sizeof( uint64_t ) * ( got ? got : 1 ) );
+      uint64_t k    = 0;
+      for ( int i = 0; i < n_readers; ++i )
+      {
+            memcpy( all + k, readers[ i ].lat,
+                    sizeof( uint64_t ) * readers[ i ].lines );
+            k += readers[ i ].lines;
+      }
+      qsort( all, got, sizeof *all, cmp_u64 );
+
+#define PCT( p ) ( got ? all[ (uint64_t)( ( got - 1 ) * ( p ) ) ] / 1000.0 : 0 )
+
+      uint64_t want = expected * (uint64_t)n_readers;
+      double secs   = ( t_last - t_start ) / 1e9;
+      printf( "{\"bench\":\"e2e\",\"rev\":\"%s\",\"label\":\"%s\","
+              "\"headless\":%s,\"packets\":%s,\"sender\":%s,\"writers\":%d,"
+              "\"readers\":%d,"
+              "\"lines_per_writer\":%ld,\"line_size\":%d,"
+              "\"lines_per_write\":%d,\"rate\":%ld,"
+              "\"delivered\":%llu,\"expected\":%llu,\"drops\":%llu,"
+              "\"garbled\":%llu,\"secs\":%.3f,\"lines_per_sec\":%.0f,"
+              "\"mb_per_sec\":%.2f,\"lat_p50_us\":%.1f,\"lat_p90_us\":%.1f,"
+              "\"lat_p99_us\":%.1f,\"lat_p999_us\":%.1f,\"lat_max_us\":%.1f,"
+              "\"daemon_cpu_s\":%.3f,\"daemon_cpu_s_per_gb\":%.3f,"
+              "\"daemon_writes\":%llu,\"writes_per_line\":%.4f,"
+              "\"send_ns_per_line\":%.1f}\n",
+              BENCH_REV, label, viewer ? "true" : "false",
+              packets ? "true" : "false", use_lib ? "true" : "false", n_writers,
+              n_readers, lines_per_w, line_size, lines_per_wr, rate,
+              (unsigned long long)got, (unsigned long long)want,
+              (unsigned long long)( want > got ? want - got : 0 ),
+              (unsigned long long)garbled, secs, secs > 0 ? got / secs : 0.0,
+              secs > 0 ? bytes / secs / 1e6 : 0.0, PCT( 0.50 ), PCT( 0.90 ),
+              PCT( 0.99 ), PCT( 0.999 ), PCT( 1.0 ), cpu,
+              bytes ? cpu / ( bytes / 1e9 ) : 0.0, syscw,
+              got ? (double)syscw / (double)got : 0.0,
+              expected ? (double)send_ns / (double)expected : 0.0 );
+      return 0;
+}
@@ -0,0 +1,125 @@
+/* nntm-send – sends lines to nntmd, spooling them while it is down
+ * gcc -Wall -O2 -o nntm-send nntm-send.c nntm_send.c -lpthread
+ *
+ *   nntm-send [-p <sock>[#<chan>]] [-s <spool> | -n] [-S <spool-bytes>]
+ *             [-w <wait-ms>] [-v] [<word>...]
+ *
+ * Sends its arguments as one line, or else every line of stdin, over one
+ * connection, reading no faster than the daemon (or the spool) takes them.
+ * Lines that cannot reach the daemon within -w milliseconds of the end go
+ * to the spool (<sock>[#<chan>].spool unless -s is given; -n for none),
+ * which the next nntm-send on it sends first. With -n, lines wait for a
+ * daemon that is down for no more than -w milliseconds, then are dropped.
+ *
+ * Exits 0 when every line went to the daemon or the spool, 2 when any
+ * was dropped (no spool, spool full, or a line longer than the buffer),
+ * 1 on bad usage or a spool that cannot be opened.
+ */
+#define _GNU_SOURCE
+#include "nntm_send.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEF_SOCK "/tmp/nntm-stream"
+#define DEF_WAIT_MS 1000
+
+int main( int argc, char **argv )
+{
+      const char *path  = DEF_SOCK;
+      const char *spool = NULL;
+      bool no_spool     = false;
+      bool verbose      = false;
+      int wait_ms       = DEF_WAIT_MS;
+      NntmSendOptions opt = { 0 };
+
+      int i = 1;
+      for ( ; i < argc && argv[ i ][ 0 ] == '-'; ++i )
+            if ( !strcmp( argv[ i ], "-p" ) && i + 1 < argc )
+                  path = argv[ ++i ];
+            else if ( !strcmp( argv[ i ], "-s" ) && i + 1 < argc )
+                  spool = argv[ ++i ];
+            else if ( !strcmp( argv[ i ], "-n" ) )
+                  no_spool = true;
+            else if ( !strcmp( argv[ i ], "-S" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) > 0 )
+                  opt.spool_bytes = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-w" ) && i + 1 < argc &&
+                      atoi( argv[ i + 1 ] ) >= 0 )
+                  wait_ms = atoi( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-v" ) )
+                  verbose = true;
+            else if ( !strcmp( argv[ i ], "--" ) )
+            {
+                  ++i;
+                  break;
+            }
+            else
+            {
+                  fprintf( stderr,
+                           "usage: %s [-p <sock>[#<chan>]] [-s <spool> | -n] "
+                           "[-S <spool-bytes>] [-w <wait-ms>] [-v] "
+                           "[<word>...]\n",
+                           argv[ 0 ] );
+                  return 1;
+            }
+
+      /* <sock>#<chan>, as nntm takes it */
+      char *sock  = strdup( path );
+      char *slash = strrchr( sock, '/' );
+      char *hash  = strchr( slash ? slash : sock, '#' );
+      if ( hash )
+      {
+            *hash    = '\0';
+            opt.chan = hash + 1;
+      }
+      char spool_def[ 4096 ];
+      snprintf( spool_def, sizeof spool_def, "%s.spool", path );
+      opt.sock_path  = sock;
+      opt.block      = true; /* a pipe is held up rather than cut */
+      opt.block_ms   = wait_ms > 0 ? wait_ms : 1; /* -n: not for good */
+      opt.spool_path = no_spool ? NULL : spool ? spool : spool_def;
+
+      bool lost   = false;
+      NntmSend *s = nntm_send_open( &opt );
+      if ( !s )
+      {
+            perror( opt.spool_path ? opt.spool_path : "nntm-send" );
+            return 1;
+      }
+
+      if ( i < argc )
+      {
+            size_t len = 0;
+            for ( int k = i; k < argc; ++k )
+                  len += strlen( argv[ k ] ) + 1;
+            char *line = malloc( len );
+            char *p    = line;
+            for ( int k = i; k < argc; ++k )
+                  p += sprintf( p, k > i ? " %s" : "%s", argv[ k ] );
+            lost |= nntm_send_line( s, line, (size_t)( p - line ) ) == -1;
+            free( line );
+      }
+      else
+      {
+            char *line = NULL;
+            size_t cap = 0;
+            ssize_t n;
+            while ( ( n = getline( &line, &cap, stdin ) ) > 0 )
+                  lost |= nntm_send_line( s, line, (size_t)n ) == -1;
+            free( line );
+      }
+
+      NntmSendStats st;
+      nntm_send_close( s, wait_ms, &st );
+      if ( verbose )
+            fprintf( stderr,
+                     "nntm-send: %llu lines sent (%llu from the spool), "
+                     "%llu spooled, %llu dropped, %llu connections\n",
+                     st.lines, st.replayed, st.spooled, st.dropped,
+                     st.connects );
+      free( sock );
+      return lost || st.dropped ? 2 : 0;
+}
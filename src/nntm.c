@@ -3,6 +3,7 @@
 /*
  * todo‑viewer.c  – ncurses list with date / priority / text columns
  */
+#define _GNU_SOURCE // for gettid(), pthread_setname_np()
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>  // for open()
@@ -11,7 +12,10 @@
 #include <ncurses.h>
 #include <poll.h>
 #include <signal.h> // for sig_atomic_t
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
@@ -22,6 +26,9 @@
 #include <sys/stat.h> // for fstat(), S_ISREG, S_ISFIFO, for streaming by pipe functionality
 #include <sys/types.h>
 
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -34,6 +41,7 @@ typedef struct
       bool completed;
       char completion_date[ 11 ]; /* YYYY‑MM‑DD               */
       char date[ 11 ];            /* due date / log date      */
+      char time[ 13 ];            /* HH:MM:SS.mmm, streams    */
       char priority[ 4 ];         /* "(A)" .. "(Z)" or ""     */
       char type[ MAX_TYPE ];      /* @context / @project      */
       char text[ MAX_LINE ];      /* whatever is left         */
@@ -71,14 +79,189 @@ bool auto_scroll_enabled = true;
 bool streaming_mode        = false;
 pthread_mutex_t todo_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// --headless: stream to stdout instead of the ncurses UI
+static bool headless             = false;
+static bool headless_json        = false;
+static const char *headless_type = NULL;
+
+/* headless: SIGINT/SIGTERM end ingest_loop, so that main flushes stdout
+ * and exits through the atexit hooks (--trace) */
+static volatile sig_atomic_t stop_ingest = 0;
+
+static void on_stop( int sig )
+{
+      (void)sig;
+      stop_ingest = 1;
+}
+
 volatile sig_atomic_t need_redraw = 0;
 int wakeup_pipe[ 2 ]; // [0] read, [1] write
 
+/* ──────────────────────────────────────────────────────── tracing ── */
+/* Opt-in span recorder (--trace FILE). Each thread owns a ring of complete
+ * events, so recording never takes a lock; rings are pushed onto a global
+ * list on first use and dumped as Chrome trace-event JSON at exit. With
+ * tracing off every probe is one predictable branch. */
+
+#define TRACE_RING 65536 /* events kept per thread, oldest overwritten */
+#define TRACE_NO_ARG -1
+
+typedef struct
+{
+      const char *name; /* static string, never freed */
+      uint64_t ts_ns;
+      uint64_t dur_ns;
+      long long arg; /* optional "n" argument, TRACE_NO_ARG if unused */
+} TraceEvent;
+
+typedef struct TraceBuf
+{
+      struct TraceBuf *next;
+      pid_t tid;
+      char thread_name[ 16 ];
+      atomic_size_t count; /* total events ever recorded */
+      TraceEvent ev[ TRACE_RING ];
+} TraceBuf;
+
+static atomic_bool trace_enabled = false;
+static const char *trace_path    = NULL;
+static _Atomic( TraceBuf * ) trace_bufs = NULL;
+static __thread TraceBuf *trace_local   = NULL;
+
+static inline uint64_t trace_now( void )
+{
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static TraceBuf *trace_buf( void )
+{
+      if ( trace_local )
+            return trace_local;
+
+      TraceBuf *b = calloc( 1, sizeof *b );
+      if ( !b )
+            return NULL;
+      b->tid = gettid();
+      pthread_getname_np( pthread_self(), b->thread_name,
+                          sizeof b->thread_name );
+
+      /* lock-free push onto the global list */
+      b->next = atomic_load( &trace_bufs );
+      while ( !atomic_compare_exchange_weak( &trace_bufs, &b->next, b ) )
+            ;
+      trace_local = b;
+      return b;
+}
+
+static void trace_emit( const char *name, uint64_t start_ns, long long arg )
+{
+      TraceBuf *b = trace_buf();
+      if ( !b )
+            return;
+
+      size_t n = atomic_load_explicit( &b->count, memory_order_relaxed );
+      /* count (n) is seen before the slot changes, for trace_flush */
+      atomic_thread_fence( memory_order_release );
+      TraceEvent *ev = &b->ev[ n % TRACE_RING ];
+      ev->name       = name;
+      ev->ts_ns      = start_ns;
+      ev->dur_ns     = trace_now() - start_ns;
+      ev->arg        = arg;
+      atomic_store_explicit( &b->count, n + 1, memory_order_release );
+}
+
+/* TRACE_BEGIN( t0 ); ...work...; TRACE_END( t0, "name" ); */
+#define TRACE_BEGIN( var )                                                     \
+      uint64_t var = atomic_load_explicit( &trace_enabled,                     \
+                                           memory_order_relaxed )              \
+                         ? trace_now()                                         \
+                         : 0
+#define TRACE_END_ARG( var, name, arg )                                        \
+      do                                                                       \
+      {                                                                        \
+            if ( var )                                                         \
+                  trace_emit( name, var, arg );                                \
+      } while ( 0 )
+#define TRACE_END( var, name ) TRACE_END_ARG( var, name, TRACE_NO_ARG )
+
+/* Names the calling thread for both the trace and perf/top (comm). */
+static void trace_thread_name( const char *name )
+{
+      pthread_setname_np( pthread_self(), name );
+      if ( trace_local )
+            snprintf( trace_local->thread_name, sizeof trace_local->thread_name,
+                      "%s", name );
+}
+
+/* Runs at exit, possibly while other threads still record (a span open
+ * when tracing stopped still ends): an event is copied first and kept
+ * only if its slot was not reused meanwhile. */
+static void trace_flush( void )
+{
+      if ( !atomic_exchange( &trace_enabled, false ) || !trace_path )
+            return;
+
+      FILE *f = fopen( trace_path, "w" );
+      if ( !f )
+      {
+            perror( "trace" );
+            return;
+      }
+
+      pid_t pid  = getpid();
+      bool first = true;
+      fputs( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", f );
+      for ( TraceBuf *b = atomic_load( &trace_bufs ); b; b = b->next )
+      {
+            fprintf( f,
+                     "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+                     "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                     first ? "" : ",\n", pid, b->tid, b->thread_name );
+            first = false;
+
+            size_t n     = atomic_load_explicit( &b->count,
+                                                 memory_order_acquire );
+            size_t begin = n > TRACE_RING ? n - TRACE_RING : 0;
+            for ( size_t i = begin; i < n; ++i )
+            {
+                  TraceEvent copy = b->ev[ i % TRACE_RING ];
+                  atomic_thread_fence( memory_order_acquire );
+                  if ( atomic_load_explicit( &b->count,
+                                             memory_order_relaxed ) >=
+                       i + TRACE_RING )
+                        continue; /* lapped: being or been overwritten */
+                  const TraceEvent *ev = &copy;
+                  fprintf( f,
+                           ",\n{\"ph\":\"X\",\"cat\":\"nntm\",\"name\":\"%s\","
+                           "\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                           ev->name, pid, b->tid, ev->ts_ns / 1000.0,
+                           ev->dur_ns / 1000.0 );
+                  if ( ev->arg != TRACE_NO_ARG )
+                        fprintf( f, ",\"args\":{\"n\":%lld}", ev->arg );
+                  fputc( '}', f );
+            }
+      }
+      fputs( "\n]}\n", f );
+      fclose( f );
+}
+
+/* pthread_mutex_lock() on the todo list, traced as "lock" (time spent
+ * waiting for the mutex, not time holding it). */
+static void todo_lock( void )
+{
+      TRACE_BEGIN( t0 );
+      pthread_mutex_lock( &todo_mutex );
+      TRACE_END( t0, "lock" );
+}
+
 static void run_exec_hook( const char *prefix, const char *text )
 {
       if ( !exec_script || !text || strlen( text ) == 0 )
             return;
 
+      TRACE_BEGIN( t0 );
       pid_t pid = fork();
       if ( pid == 0 )
       {
@@ -99,6 +282,7 @@ static void run_exec_hook( const char *prefix, const char *text )
             _exit( 127 ); // only reached if execl fails
       }
       // Parent continues immediately
+      TRACE_END( t0, "exec_hook" );
 }
 
 static void remove_oldest_todo( void )
@@ -262,6 +446,8 @@ static int compare_date( const void *a, const void *b )
       const Todo *tb = (const Todo *)b;
 
       int cmp = strncmp( ta->date, tb->date, 10 );
+      if ( !cmp )
+            cmp = strcmp( ta->time, tb->time ); /* "" in a todo file */
       return sort_date_descending ? -cmp : cmp;
 }
 static int compare_priority( const void *a, const void *b )
@@ -437,7 +623,7 @@ static void prompt_type( void )
 
                   if ( strlen( input ) > 0 )
                   {
-                        strncpy( t->type, input, MAX_TYPE - 1 );
+                        snprintf( t->type, sizeof t->type, "%s", input );
                         add_type( input );
                         save_todos_to_file();
                   }
@@ -484,7 +670,7 @@ void load_todos( const char *filename )
 
             Todo *t = &todos[ todo_count ];
             memset( t, 0, sizeof( Todo ) );
-            strncpy( t->text, line, MAX_LINE - 1 );
+            snprintf( t->text, sizeof t->text, "%s", line );
             strcpy( t->date, "2025-05-12" ); // dummy
             strcpy( t->type, "stream" );
             t->completed = false;
@@ -506,7 +692,7 @@ void load_todos( const char *filename )
             if ( p[ 0 ] == '(' && isalpha( (unsigned char)p[ 1 ] ) &&
                  p[ 2 ] == ')' )
             {
-                  strncpy( t->priority, p, 3 );
+                  memcpy( t->priority, p, 3 );
                   t->priority[ 3 ] = '\0';
                   p += 4;
                   while ( isspace( (unsigned char)*p ) )
@@ -527,7 +713,7 @@ void load_todos( const char *filename )
             if ( t->priority[ 0 ] == '\0' && p[ 0 ] == '(' &&
                  isalpha( (unsigned char)p[ 1 ] ) && p[ 2 ] == ')' )
             {
-                  strncpy( t->priority, p, 3 );
+                  memcpy( t->priority, p, 3 );
                   t->priority[ 3 ] = '\0';
                   p += 4;
                   while ( isspace( (unsigned char)*p ) )
@@ -560,12 +746,14 @@ void load_todos( const char *filename )
 
 static void save_todos_to_file( void )
 {
-      pthread_mutex_lock( &todo_mutex );
+      TRACE_BEGIN( t0 );
+      todo_lock();
       FILE *f = fopen( todo_filename, "w" );
       if ( !f )
       {
             perror( "write" );
             pthread_mutex_unlock( &todo_mutex );
+            TRACE_END( t0, "save_todos_to_file" );
             return;
       }
 
@@ -597,6 +785,7 @@ static void save_todos_to_file( void )
 
       fclose( f );
       pthread_mutex_unlock( &todo_mutex );
+      TRACE_END_ARG( t0, "save_todos_to_file", todo_count );
 }
 
 /* ───────────────────────────────────────────── logic ── */
@@ -736,6 +925,99 @@ static const char *trimmed( const char *s )
       return buffer;
 }
 
+/* Delivery latency of lines nntmd stamped with their time (-T), from
+ * its stamp to their commit here: le[ i ] counts those of up to 2^i µs,
+ * the last bucket any longer. Kept by the ingest thread, read by the UI. */
+#define LAG_BUCKETS 24
+
+static atomic_ullong lag_hist[ LAG_BUCKETS ];
+static atomic_ullong lag_count    = 0;
+static atomic_ullong lag_max_us   = 0;
+static atomic_ullong missed_lines = 0; /* jumps in sequence numbers */
+static bool show_lag              = false;
+
+static void lag_add( uint64_t us )
+{
+      int b = 0;
+      while ( b < LAG_BUCKETS - 1 && ( 1ull << b ) < us )
+            ++b;
+      atomic_fetch_add_explicit( &lag_hist[ b ], 1, memory_order_relaxed );
+      atomic_fetch_add_explicit( &lag_count, 1, memory_order_relaxed );
+      unsigned long long max = atomic_load( &lag_max_us );
+      while ( us > max &&
+              !atomic_compare_exchange_weak( &lag_max_us, &max, us ) )
+            ;
+}
+
+/* Upper bound (µs) of the bucket the `q` quantile of the latencies is in,
+ * or the largest seen if that is less */
+static unsigned long long lag_quantile( double q )
+{
+      unsigned long long n    = atomic_load( &lag_count );
+      unsigned long long max  = atomic_load( &lag_max_us );
+      unsigned long long seen = 0;
+      for ( int b = 0; b < LAG_BUCKETS - 1; ++b )
+      {
+            seen += atomic_load_explicit( &lag_hist[ b ], memory_order_relaxed );
+            if ( seen && (double)seen >= q * (double)n )
+                  return ( 1ull << b ) < max ? 1ull << b : max;
+      }
+      return max;
+}
+
+/* "1.2ms"-style text for `us` microseconds */
+static const char *lag_text( char *buf, size_t size, unsigned long long us )
+{
+      if ( us < 1000 )
+            snprintf( buf, size, "%lluus", us );
+      else if ( us < 1000000 )
+            snprintf( buf, size, "%.1fms", us / 1e3 );
+      else
+            snprintf( buf, size, "%.1fs", us / 1e6 );
+      return buf;
+}
+
+/* Latency histogram overlay ('L'): one bar per bucket that has any. */
+static void draw_lag( void )
+{
+      attron( COLOR_PAIR( 2 ) | A_BOLD );
+      mvprintw( 0, 0, "DELIVERY LATENCY — nntmd stamp to screen — press any key" );
+      attroff( COLOR_PAIR( 2 ) | A_BOLD );
+
+      unsigned long long n = atomic_load( &lag_count );
+      if ( !n )
+      {
+            mvprintw( 2, 2, "no stamped lines yet (start nntmd with -T)" );
+            return;
+      }
+      unsigned long long most = 0;
+      for ( int b = 0; b < LAG_BUCKETS; ++b )
+            if ( atomic_load( &lag_hist[ b ] ) > most )
+                  most = atomic_load( &lag_hist[ b ] );
+
+      int row   = 2;
+      int bar_w = COLS - 34;
+      for ( int b = 0; b < LAG_BUCKETS && row < LINES - 1; ++b )
+      {
+            unsigned long long k = atomic_load( &lag_hist[ b ] );
+            if ( !k )
+                  continue;
+            char le[ 16 ];
+            mvprintw( row, 2, "%s %-7s %10llu ", b == LAG_BUCKETS - 1 ? ">" : "≤",
+                      lag_text( le, sizeof le, 1ull << b ), k );
+            int w = bar_w > 0 ? (int)( k * (unsigned long long)bar_w / most ) : 0;
+            attron( COLOR_PAIR( 3 ) );
+            for ( int i = 0; i < w; ++i )
+                  addch( '#' );
+            attroff( COLOR_PAIR( 3 ) );
+            ++row;
+      }
+      char max[ 16 ];
+      mvprintw( row + 1, 2, "%llu lines, max %s, %llu missed", n,
+                lag_text( max, sizeof max, atomic_load( &lag_max_us ) ),
+                (unsigned long long)atomic_load( &missed_lines ) );
+}
+
 /* ---------------------------------------------------------------------------
  *  draw_ui  – one full screen refresh
  * ------------------------------------------------------------------------- */
@@ -755,7 +1037,8 @@ static void draw_ui( void )
       /* --------------------------------------------------- column map  */
       const int TYPE_COL_W = 8;             /* width of "@foo"   */
       const int DATE_COL   = panel_w + 2;   /* YYYY‑MM‑DD        */
-      const int PRIO_COL   = DATE_COL + 11; /* "(A)"             */
+      const int PRIO_COL   = DATE_COL + ( streaming_mode ? 13 : 11 );
+                                            /* "(A)"             */
       const int TYPE_COL   = PRIO_COL + 4;  /* @type (optional)  */
 
       const bool show_type_col = strcmp( types[ selected_type ], "all" ) == 0;
@@ -773,7 +1056,17 @@ static void draw_ui( void )
             mvprintw( 3, 2, "h/l        switch context" );
             mvprintw( 4, 2, "SPACE      toggle completed" );
             mvprintw( 5, 2, "?          help" );
-            mvprintw( 6, 2, "q          quit" );
+            mvprintw( 6, 2, "L          delivery latency (nntmd -T)" );
+            mvprintw( 7, 2, "q          quit" );
+            wnoutrefresh( stdscr );
+            doupdate();
+            return;
+      }
+
+      /* ---------------------------------------------- latency overlay  */
+      if ( show_lag )
+      {
+            draw_lag();
             wnoutrefresh( stdscr );
             doupdate();
             return;
@@ -787,6 +1080,22 @@ static void draw_ui( void )
                   : ( COLOR_PAIR( 8 ) | A_BOLD ) );
       printw( "@%s", types[ selected_type ] );
       attroff( COLOR_PAIR( 8 ) | COLOR_PAIR( 9 ) | A_BOLD );
+      if ( atomic_load( &lag_count ) )
+      {
+            char p50[ 16 ], p99[ 16 ], max[ 16 ], head[ 96 ];
+            int n = snprintf(
+                head, sizeof head, "lag p50 %s p99 %s max %s  missed %llu",
+                lag_text( p50, sizeof p50, lag_quantile( 0.5 ) ),
+                lag_text( p99, sizeof p99, lag_quantile( 0.99 ) ),
+                lag_text( max, sizeof max, atomic_load( &lag_max_us ) ),
+                (unsigned long long)atomic_load( &missed_lines ) );
+            if ( n < COLS - 30 )
+            {
+                  attron( COLOR_PAIR( 5 ) );
+                  mvprintw( 0, COLS - n - 1, "%s", head );
+                  attroff( COLOR_PAIR( 5 ) );
+            }
+      }
       mvhline( 1, 0, '-', COLS );
 
       /* ------------------------------------------------ list viewport  */
@@ -798,8 +1107,7 @@ static void draw_ui( void )
       else if ( selected_index >= scroll_offset + visible_lines )
             scroll_offset = selected_index - visible_lines + 1;
 
-      pthread_mutex_lock( &todo_mutex ); // else causes not all lines to be
-                                         // printed on high stress
+      todo_lock(); // else causes not all lines to be printed on high stress
       int local_idx = 0;
       for ( int i = 0; i < todo_count; ++i )
       {
@@ -832,7 +1140,7 @@ static void draw_ui( void )
             }
 
             attron( date_attr );
-            mvprintw( row, DATE_COL, "%s", t->date );
+            mvprintw( row, DATE_COL, "%s", *t->time ? t->time : t->date );
             attroff( date_attr );
 
             if ( *t->priority )
@@ -922,359 +1230,1099 @@ static inline void safe_draw_ui( void )
       write( wakeup_pipe[ 1 ], "x", 1 ); // wake up UI thread
 }
 
-/* ──────────────────────────────────────────────── funcs, streaming, by pipe ──
- */
+/* ─────────────────────────────────────────────── stream ingest ── */
+/* Every streaming source funnels through here: raw bytes are read straight
+ * into a LineBuf behind whatever partial line the previous read left, each
+ * complete line is parsed once, and the whole batch is committed under a
+ * single lock (or, headless, appended to the stdout buffer). */
 
-bool is_unix_socket( const char *path )
+#define STREAM_READ ( 256 * 1024 ) /* bytes per read() */
+
+typedef struct
 {
-      struct stat st;
-      if ( stat( path, &st ) == -1 )
+      char buf[ STREAM_READ + MAX_LINE ];
+      size_t len;    /* partial line carried over from the previous read */
+      bool skipping; /* inside an over-long line: drop until its '\n'    */
+      bool stamped;  /* lines come as "<seq>[:<ns>]\t<line>" (nntmd -d/-T) */
+      uint64_t last_seq; /* newest sequence number seen, 0 for none      */
+} LineBuf;
+
+/* Local "YYYY-MM-DD" and "HH:MM:SS.mmm" of a CLOCK_REALTIME instant;
+ * localtime_r() runs at most once a second per thread. */
+static void stamp_text( uint64_t ns, char *date, char *clock )
+{
+      static __thread time_t last = -1;
+      static __thread char d[ 11 ], hms[ 9 ];
+
+      time_t sec = (time_t)( ns / 1000000000ull );
+      if ( sec != last )
       {
-            perror( "stat" );
+            struct tm tm;
+            localtime_r( &sec, &tm );
+            strftime( d, sizeof d, "%Y-%m-%d", &tm );
+            strftime( hms, sizeof hms, "%H:%M:%S", &tm );
+            last = sec;
+      }
+      unsigned ms = (unsigned)( ns / 1000000 % 1000 );
+      memcpy( date, d, sizeof d );
+      memcpy( clock, hms, 8 );
+      clock[ 8 ]  = '.';
+      clock[ 9 ]  = (char)( '0' + ms / 100 );
+      clock[ 10 ] = (char)( '0' + ms / 10 % 10 );
+      clock[ 11 ] = (char)( '0' + ms % 10 );
+      clock[ 12 ] = '\0';
+}
+
+/* Splits one stream line into @type and text: the first "@word" anywhere in
+ * the line is the type, and the text is what follows it (anything before
+ * it is dropped). Returns false for blank lines. `line` is left untouched. */
+static bool parse_stream_line( const char *line, const char *date, Todo *t )
+{
+      while ( *line && isspace( (unsigned char)*line ) )
+            ++line;
+      if ( !*line )
             return false;
+
+      memset( t, 0, sizeof( Todo ) );
+      t->completed = false;
+      memcpy( t->date, date, sizeof( t->date ) );
+
+      const char *at = strchr( line, '@' );
+      if ( !at )
+      {
+            strcpy( t->type, "all" );
+            memcpy( t->text, line, strnlen( line, MAX_LINE - 1 ) );
+            return true;
+      }
+
+      const char *end = at + 1;
+      while ( *end && !isspace( (unsigned char)*end ) )
+            ++end;
+
+      size_t type_len = end - ( at + 1 );
+      if ( type_len > 0 && type_len < MAX_TYPE )
+      {
+            memcpy( t->type, at + 1, type_len );
+            t->type[ type_len ] = '\0';
       }
+      else
+            strcpy( t->type, "all" );
 
-      return S_ISSOCK( st.st_mode );
+      /* text = everything after the @type */
+      while ( *end == ' ' )
+            ++end;
+      memcpy( t->text, end, strnlen( end, MAX_LINE - 1 ) );
+      return true;
 }
 
-void *handle_socket_client( void *arg )
+/* ─── headless sink: large buffered writes straight to stdout ─── */
+
+#define HEADLESS_OUT ( 1024 * 1024 )
+
+static char headless_out[ HEADLESS_OUT ];
+static size_t headless_len = 0;
+
+static void headless_flush( void )
 {
-      int client_fd = *(int *)arg;
-      free( arg );
+      size_t off = 0;
+      while ( off < headless_len )
+      {
+            ssize_t n =
+                write( STDOUT_FILENO, headless_out + off, headless_len - off );
+            if ( n == -1 )
+            {
+                  if ( errno == EINTR )
+                        continue;
+                  perror( "stdout" );
+                  exit( 1 );
+            }
+            off += (size_t)n;
+      }
+      headless_len = 0;
+}
 
-      char buf[ 512 ];
-      char assembly[ 2 * MAX_LINE ];
-      size_t asm_len         = 0;
-      struct timeval last_ui = { 0 };
+static void headless_put( const char *s, size_t len )
+{
+      if ( headless_len + len > sizeof headless_out )
+            headless_flush();
+      memcpy( headless_out + headless_len, s, len );
+      headless_len += len;
+}
 
-      while ( 1 )
+static void headless_put_json_str( const char *s )
+{
+      char esc[ 8 ];
+      headless_put( "\"", 1 );
+      for ( const char *run = s;; ++s )
       {
-            ssize_t n = read( client_fd, buf, sizeof( buf ) );
-            if ( n <= 0 )
-                  break;
+            unsigned char c = (unsigned char)*s;
+            if ( c && c != '"' && c != '\\' && c >= 0x20 )
+                  continue;
 
-            if ( asm_len + n > sizeof( assembly ) )
-                  n = sizeof( assembly ) - asm_len;
+            headless_put( run, s - run );
+            if ( !c )
+                  break;
+            snprintf( esc, sizeof esc,
+                      c == '"' || c == '\\' ? "\\%c" : "\\u%04x", c );
+            headless_put( esc, strlen( esc ) );
+            run = s + 1;
+      }
+      headless_put( "\"", 1 );
+}
 
-            memcpy( assembly + asm_len, buf, n );
-            asm_len += (size_t)n;
+static void headless_emit( const char *line, const char *tag, const Todo *t,
+                           long long lag_us )
+{
+      if ( headless_type && strcmp( t->type, headless_type ) != 0 )
+            return;
 
-            size_t start = 0;
-            while ( 1 )
+      if ( !headless_json )
+      {
+            if ( tag )
             {
-                  void *nlp = memchr( assembly + start, '\n', asm_len - start );
-                  if ( !nlp )
-                        break;
+                  headless_put( "@", 1 );
+                  headless_put( tag, strlen( tag ) );
+                  headless_put( " ", 1 );
+            }
+            headless_put( line, strlen( line ) );
+            headless_put( "\n", 1 );
+            return;
+      }
 
-                  size_t len = (char *)nlp - ( assembly + start );
-                  if ( len > 0 && len < MAX_LINE )
-                  {
-                        assembly[ start + len ] = '\0';
-                        char *line              = assembly + start;
+      headless_put( "{\"date\":", 8 );
+      headless_put_json_str( t->date );
+      headless_put( ",\"time\":", 8 );
+      headless_put_json_str( t->time );
+      if ( lag_us >= 0 )
+      {
+            char num[ 32 ];
+            int n = snprintf( num, sizeof num, ",\"lag_us\":%lld", lag_us );
+            headless_put( num, (size_t)n );
+      }
+      headless_put( ",\"type\":", 8 );
+      headless_put_json_str( t->type );
+      headless_put( ",\"text\":", 8 );
+      headless_put_json_str( t->text );
+      headless_put( "}\n", 2 );
+}
 
-                        while ( *line && isspace( (unsigned char)*line ) )
-                              ++line;
+/* ─── viewer sink: append to the todo list (todo_mutex held) ─── */
 
-                        if ( *line )
-                        {
-                              pthread_mutex_lock( &todo_mutex );
+static void commit_stream_todo( const Todo *t )
+{
+      if ( todo_count >= MAX_TODOS )
+            remove_oldest_todo();
 
-                              if ( todo_count >= MAX_TODOS )
-                                    remove_oldest_todo();
-                              else
-                              {
-                                    Todo *t = &todos[ todo_count++ ];
-                                    memset( t, 0, sizeof( Todo ) );
-
-                                    t->completed  = false;
-                                    time_t now    = time( NULL );
-                                    struct tm *tm = localtime( &now );
-                                    strftime( t->date, sizeof( t->date ),
-                                              "%Y-%m-%d", tm );
-
-                                    const char *at = strchr( line, '@' );
-                                    if ( at )
-                                    {
-                                          const char *end = at + 1;
-                                          while (
-                                              *end &&
-                                              !isspace( (unsigned char)*end ) )
-                                                ++end;
-
-                                          size_t type_len = end - ( at + 1 );
-                                          if ( type_len > 0 &&
-                                               type_len < MAX_TYPE )
-                                          {
-                                                strncpy( t->type, at + 1,
-                                                         type_len );
-                                                t->type[ type_len ] = '\0';
-                                                add_type( t->type );
-                                          }
-                                          else
-                                          {
-                                                strncpy( t->type, "all",
-                                                         sizeof( t->type ) );
-                                          }
-
-                                          size_t offset = at - line;
-                                          memmove( line + offset, end,
-                                                   strlen( end ) + 1 );
-                                          while ( line[ offset ] == ' ' )
-                                                offset++;
-                                          strncpy( t->text, line + offset,
-                                                   MAX_LINE - 1 );
-                                    }
-                                    else
-                                    {
-                                          strncpy( t->type, "all",
-                                                   sizeof( t->type ) );
-                                          strncpy( t->text, line,
-                                                   MAX_LINE - 1 );
-                                    }
-
-                                    if ( auto_scroll_enabled )
-                                    {
-                                          selected_index =
-                                              count_visible_items_for_type(
-                                                  types[ selected_type ] ) -
-                                              1;
-                                          scroll_offset =
-                                              selected_index - ( LINES - 3 );
-                                          if ( scroll_offset < 0 )
-                                                scroll_offset = 0;
-                                    }
-                              }
+      todos[ todo_count++ ] = *t;
+      add_type( t->type );
+}
 
-                              pthread_mutex_unlock( &todo_mutex );
-                        }
-                  }
+/* Parses one complete line and hands it on; returns true if it held
+ * anything. `lag_us` is its delivery latency, -1 if it is not known. */
+static bool ingest_line( char *p, const char *date, const char *clock,
+                         long long lag_us, const char *tag )
+{
+      Todo t;
+      if ( !parse_stream_line( p, date, &t ) )
+            return false;
+      memcpy( t.time, clock, sizeof t.time );
+
+      bool tagged = tag && strcmp( t.type, "all" ) == 0;
+      if ( tagged )
+            snprintf( t.type, sizeof t.type, "%s", tag );
+
+      if ( headless )
+            headless_emit( p, tagged ? tag : NULL, &t, lag_us );
+      else
+            commit_stream_todo( &t );
+      return true;
+}
+
+/* Strips the "<seq>[:<ns>]\t" of a stamped line, setting `ns` to its
+ * time if it has one, and notes a jump in sequence numbers (lines the
+ * daemon no longer had, or dropped for this reader) as a line of its own.
+ * Lines without a number, such as the daemon's own markers, pass as they
+ * are. */
+static char *strip_seq( LineBuf *lb, char *p, const char *date,
+                        const char *clock, int *committed, uint64_t *ns )
+{
+      char *tab;
+      unsigned long long seq = strtoull( p, &tab, 10 );
+      unsigned long long t   = 0;
+      if ( tab != p && *tab == ':' )
+            t = strtoull( tab + 1, &tab, 10 );
+      if ( tab == p || *tab != '\t' )
+            return p;
+      *ns = t;
+
+      if ( lb->last_seq && seq > lb->last_seq + 1 )
+      {
+            char gap[ 96 ];
+            snprintf( gap, sizeof gap, "@nntmd missed lines %llu..%llu",
+                      (unsigned long long)lb->last_seq + 1, seq - 1 );
+            atomic_fetch_add( &missed_lines, seq - 1 - lb->last_seq );
+            *committed += ingest_line( gap, date, clock, -1, NULL );
+      }
+      lb->last_seq = seq; /* lower after a daemon lost its log: start over */
+      return tab + 1;
+}
+
+/* Consumes the `n` fresh bytes just read to lb->buf + lb->len. Lines
+ * without an @type get `tag` as their type when one is given. */
+static void stream_ingest( LineBuf *lb, size_t n, const char *tag )
+{
+      TRACE_BEGIN( tc );
+      int committed = 0;
+      if ( !headless )
+            todo_lock();
+
+      /* lines are stamped with the time they are committed, or with
+       * their daemon's stamp if they carry one */
+      struct timespec ts;
+      clock_gettime( CLOCK_REALTIME, &ts );
+      uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+      char date[ 11 ], clock[ 13 ];
+      stamp_text( now, date, clock );
+
+      char *p   = lb->buf;
+      char *end = lb->buf + lb->len + n;
+      for ( ;; )
+      {
+            char *nl = memchr( p, '\n', end - p );
+            if ( !nl )
+                  break;
 
-                  start += len + 1;
+            size_t len = nl - p;
+            *nl        = '\0';
+            if ( lb->skipping )
+                  lb->skipping = false; /* tail of an over-long line */
+            else if ( len > 0 && len < MAX_LINE )
+            {
+                  if ( p[ len - 1 ] == '\r' )
+                        p[ len - 1 ] = '\0';
+
+                  uint64_t ns = 0;
+                  char *line  = lb->stamped ? strip_seq( lb, p, date, clock,
+                                                         &committed, &ns )
+                                            : p;
+                  if ( ns )
+                  {
+                        char d[ 11 ], c[ 13 ];
+                        uint64_t us = now > ns ? ( now - ns ) / 1000 : 0;
+                        stamp_text( ns, d, c );
+                        lag_add( us );
+                        committed +=
+                            ingest_line( line, d, c, (long long)us, tag );
+                  }
+                  else
+                        committed += ingest_line( line, date, clock, -1, tag );
             }
+            p = nl + 1;
+      }
 
-            if ( start < asm_len )
+      if ( !headless )
+      {
+            if ( committed && auto_scroll_enabled )
             {
-                  memmove( assembly, assembly + start, asm_len - start );
-                  asm_len -= start;
+                  selected_index =
+                      count_visible_items_for_type( types[ selected_type ] ) -
+                      1;
+                  scroll_offset = selected_index - ( LINES - 3 );
+                  if ( scroll_offset < 0 )
+                        scroll_offset = 0;
             }
-            else
+            pthread_mutex_unlock( &todo_mutex );
+      }
+      TRACE_END_ARG( tc, "commit", committed );
+
+      /* keep the partial tail; an unterminated line longer than MAX_LINE is
+       * dropped up to its newline */
+      lb->len = end - p;
+      if ( lb->len >= MAX_LINE )
+      {
+            lb->len      = 0;
+            lb->skipping = true;
+      }
+      else if ( lb->len && p != lb->buf )
+            memmove( lb->buf, p, lb->len );
+}
+
+/* ─────────────────────────────────────────────── ingest engine ── */
+/* One epoll loop on one thread serves every streaming source given on the
+ * command line. Each source keeps its own LineBuf, so lines never mix
+ * across sources, and lost sockets are retried from the loop's timeout
+ * instead of a sleeping thread per source. */
+
+#define MAX_SOURCES 64
+#define RECONNECT_MS 1000
+#define REDRAW_MS 50
+#define FIFO_PIPE_SZ ( 1024 * 1024 ) /* asked for; halved until allowed */
+
+typedef enum
+{
+      SRC_SOCKET, /* nntmd reader connection */
+      SRC_FIFO,   /* named pipe written to directly by producers */
+      SRC_FILE,   /* regular file followed like tail -F (--follow) */
+} SourceKind;
+
+typedef enum
+{
+      SRC_IDLE,      /* closed, reopen at retry_at */
+      SRC_HANDSHAKE, /* READER sent, skipping the "OK" line */
+      SRC_LIVE,
+} SourceState;
+
+typedef struct
+{
+      const char *path;
+      char tag[ MAX_TYPE ];  /* @type for untyped lines, "" for none */
+      char chan[ MAX_TYPE ]; /* nntmd channel to read, "" for the default */
+      SourceKind kind;
+      SourceState state;
+      int fd;
+      uint64_t retry_at; /* now_ms() of the next reopen attempt */
+      LineBuf *lb;
+
+      /* SRC_FILE only */
+      const char *base; /* file name within its directory */
+      int wd;           /* inotify watch on the open file, -1 if none */
+      int dir_wd;       /* inotify watch on its directory (rotation) */
+      dev_t dev;
+      ino_t ino;
+      off_t offset; /* next byte to pread() */
+
+      /* SRC_SOCKET reading nntmd's shared memory ring instead (-M) */
+      int shm_efd; /* woken through it, -1 if not; data.ptr == &shm_efd */
+      int shm_slot;
+      struct ShmHeader *shm_hdr;
+      const char *shm_data;
+      uint64_t shm_pos; /* stream offset of the next byte to copy */
+} Source;
+
+static Source sources[ MAX_SOURCES ];
+static int source_count = 0;
+static int ingest_ep    = -1;
+static int inotify_fd   = -1; /* epoll data.ptr == &inotify_fd */
+
+static bool follow_files = false; /* --follow: tail regular files */
+static int follow_lines  = MAX_TODOS; /* --lines: backlog on first open */
+
+static uint64_t now_ms( void )
+{
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Sockets and FIFOs are streamed; anything else is a todo file. */
+static bool stream_source_kind( const char *path, SourceKind *kind )
+{
+      struct stat st;
+      if ( stat( path, &st ) == -1 )
+      {
+            /* a followed log may not have been created yet */
+            if ( errno == ENOENT && follow_files )
             {
-                  asm_len = 0;
+                  *kind = SRC_FILE;
+                  return true;
             }
+            perror( path );
+            return false;
+      }
+
+      if ( S_ISSOCK( st.st_mode ) )
+            *kind = SRC_SOCKET;
+      else if ( S_ISFIFO( st.st_mode ) )
+            *kind = SRC_FIFO;
+      else if ( S_ISREG( st.st_mode ) && follow_files )
+            *kind = SRC_FILE;
+      else
+            return false;
+      return true;
+}
 
-            struct timeval now_tv;
-            gettimeofday( &now_tv, NULL );
-            long diff_ms = ( now_tv.tv_sec - last_ui.tv_sec ) * 1000 +
-                           ( now_tv.tv_usec - last_ui.tv_usec ) / 1000;
-            if ( diff_ms > 50 )
+/* Where the "#<chan>" of "<socket>#<chan>" (a channel of the daemon
+ * there) starts in `path`, NULL if it has none. */
+static const char *source_chan( const char *path )
+{
+      const char *slash = strrchr( path, '/' );
+      const char *hash  = strchr( slash ? slash : path, '#' );
+      return hash && hash[ 1 ] ? hash : NULL;
+}
+
+/* "name=path" names the source explicitly; otherwise, with more than one
+ * source, untyped lines get the channel name, or the file name without
+ * its extension. */
+static void add_source( const char *arg, bool tagged )
+{
+      Source *s = &sources[ source_count++ ];
+      memset( s, 0, sizeof *s );
+      s->fd      = -1;
+      s->wd      = -1;
+      s->dir_wd  = -1;
+      s->shm_efd = -1;
+      s->path    = arg;
+
+      const char *eq = strchr( arg, '=' );
+      if ( eq && eq != arg && !memchr( arg, '/', eq - arg ) )
+      {
+            s->path = eq + 1;
+            snprintf( s->tag, sizeof s->tag, "%.*s", (int)( eq - arg ), arg );
+      }
+      const char *hash = source_chan( s->path );
+      if ( hash )
+      {
+            snprintf( s->chan, sizeof s->chan, "%s", hash + 1 );
+            if ( !( s->path = strndup( s->path, (size_t)( hash - s->path ) ) ) )
             {
-                  safe_draw_ui();
-                  last_ui = now_tv;
+                  perror( "strndup" );
+                  exit( 1 );
             }
       }
+      const char *slash = strrchr( s->path, '/' );
+      s->base           = slash ? slash + 1 : s->path;
 
-      close( client_fd );
-      return NULL;
+      if ( !s->tag[ 0 ] && tagged && s->chan[ 0 ] )
+            memcpy( s->tag, s->chan, sizeof s->tag );
+      else if ( !s->tag[ 0 ] && tagged )
+      {
+            snprintf( s->tag, sizeof s->tag, "%s", s->base );
+            char *dot = strchr( s->tag, '.' );
+            if ( dot && dot != s->tag )
+                  *dot = '\0';
+      }
+
+      s->lb = calloc( 1, sizeof( LineBuf ) );
+      if ( !s->lb )
+      {
+            perror( "calloc" );
+            exit( 1 );
+      }
 }
-/* ------------------------------------------------------------------ */
-/* CONNECT-MODE reader                                                */
-static void *socket_reader_thread( void *arg )
-/* ------------------------------------------------------------------ */
+
+static void shm_detach( Source *s );
+
+static void source_close( Source *s )
 {
-      const char *sock = (const char *)arg;
+      if ( s->shm_efd != -1 )
+            shm_detach( s );
+      if ( s->fd != -1 )
+      {
+            if ( s->kind != SRC_FILE )
+                  epoll_ctl( ingest_ep, EPOLL_CTL_DEL, s->fd, NULL );
+            close( s->fd );
+      }
+      if ( s->wd != -1 )
+            inotify_rm_watch( inotify_fd, s->wd );
+      s->wd           = -1;
+      s->fd           = -1;
+      s->state        = SRC_IDLE;
+      s->retry_at     = now_ms() + RECONNECT_MS;
+      s->lb->len      = 0;
+      s->lb->skipping = false;
+}
 
-reconnect:
-      /* ① create & connect ------------------------------------------------ */
-      int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+/* Opens a FIFO for reading without waiting for a writer. A reader opened
+ * like this reports no hang-up until a writer has come and gone, so an
+ * idle FIFO costs nothing and a finished writer is handled by reopening
+ * (see source_readable) rather than by polling. */
+static int fifo_open( const char *path )
+{
+      int fd = open( path, O_RDONLY | O_NONBLOCK | O_CLOEXEC );
       if ( fd == -1 )
+            return -1;
+
+      /* a deep pipe lets producers run ahead between our reads */
+      for ( int sz = FIFO_PIPE_SZ; sz > 64 * 1024; sz /= 2 )
+            if ( fcntl( fd, F_SETPIPE_SZ, sz ) != -1 )
+                  break;
+      return fd;
+}
+
+/* ─── followed files (--follow) ─── */
+
+/* Offset at which the last `lines` lines of `fd` start, found by scanning
+ * backwards from `size` for newlines instead of reading the whole file. */
+static off_t tail_offset( int fd, off_t size, int lines )
+{
+      char buf[ 64 * 1024 ];
+      off_t pos = size;
+
+      if ( lines <= 0 )
+            return size;
+
+      while ( pos > 0 )
       {
-            perror( "socket" );
-            sleep( 1 );
-            goto reconnect;
+            size_t chunk = pos < (off_t)sizeof buf ? (size_t)pos : sizeof buf;
+            pos -= (off_t)chunk;
+            if ( pread( fd, buf, chunk, pos ) != (ssize_t)chunk )
+                  return 0;
+
+            size_t len = chunk;
+            char *nl;
+            while ( ( nl = memrchr( buf, '\n', len ) ) )
+            {
+                  off_t at = pos + ( nl - buf );
+                  len      = (size_t)( nl - buf );
+                  /* the newline ending the file closes the last line */
+                  if ( at != size - 1 && --lines == 0 )
+                        return at + 1;
+            }
       }
+      return 0;
+}
 
-      struct sockaddr_un sa = { .sun_family = AF_UNIX };
-      strncpy( sa.sun_path, sock, sizeof( sa.sun_path ) - 1 );
+/* Ingests everything between s->offset and EOF. A file that shrank was
+ * truncated in place (copytruncate) and is read again from the start. */
+static bool file_drain( Source *s )
+{
+      LineBuf *lb = s->lb;
+      struct stat st;
+      if ( fstat( s->fd, &st ) == 0 && st.st_size < s->offset )
+      {
+            s->offset    = 0;
+            lb->len      = 0;
+            lb->skipping = false;
+      }
 
-      if ( connect( fd, (struct sockaddr *)&sa, sizeof sa ) == -1 )
+      bool got = false;
+      for ( ;; )
       {
-            perror( "connect" );
-            close( fd );
-            sleep( 1 );
-            goto reconnect;
+            TRACE_BEGIN( tr );
+            ssize_t n =
+                pread( s->fd, lb->buf + lb->len, STREAM_READ, s->offset );
+            TRACE_END_ARG( tr, "read", n );
+            if ( n == -1 && errno == EINTR )
+                  continue;
+            if ( n <= 0 )
+                  break;
+
+            s->offset += n;
+            stream_ingest( lb, (size_t)n, s->tag[ 0 ] ? s->tag : NULL );
+            got = true;
+            if ( n < STREAM_READ )
+                  break; /* reached EOF, skip the extra 0-byte pread */
       }
+      return got;
+}
 
-      /* ② announce ourselves as reader ----------------------------------- */
-      if ( write( fd, "READER\n", 7 ) != 7 )
+/* Opens s->path and watches it. The very first open starts follow_lines
+ * lines before the end; a file that replaced a rotated one is read from
+ * its beginning. */
+static bool file_open( Source *s, bool first )
+{
+      if ( s->dir_wd == -1 )
       {
-            perror( "handshake-write" );
-            close( fd );
-            sleep( 1 );
-            goto reconnect;
+            char dir[ PATH_MAX ] = ".";
+            if ( s->base != s->path )
+                  snprintf( dir, sizeof dir, "%.*s",
+                            (int)( s->base - s->path ), s->path );
+            s->dir_wd =
+                inotify_add_watch( inotify_fd, dir, IN_CREATE | IN_MOVED_TO );
       }
 
-      /* daemon answers “OK\n”; ignore contents but read it so it’s gone */
-      char ack[ 4 ];
-      read( fd, ack, sizeof ack );
+      struct stat st;
+      int fd = open( s->path, O_RDONLY | O_CLOEXEC );
+      if ( fd == -1 || fstat( fd, &st ) == -1 )
+      {
+            if ( fd != -1 )
+                  close( fd );
+            s->retry_at = now_ms() + RECONNECT_MS;
+            return false;
+      }
 
-      /* ③ run the normal line-by-line reader loop ------------------------ */
-      int *p = malloc( sizeof *p );
-      *p     = fd;
-      handle_socket_client( p ); /* will return when connection dies */
+      /* watch before the first drain so no append slips in between */
+      s->wd = inotify_add_watch( inotify_fd, s->path,
+                                 IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF );
+      s->fd     = fd;
+      s->dev    = st.st_dev;
+      s->ino    = st.st_ino;
+      s->offset = first ? tail_offset( fd, st.st_size, follow_lines ) : 0;
+      s->state  = SRC_LIVE;
+      return file_drain( s );
+}
 
-      /* ④ auto-reconnect -------------------------------------------------- */
-      free( p ); /* handle_socket_client closed fd for us     */
-      sleep( 1 );
-      goto reconnect;
-      return NULL; // 🔧 Add this line to silence the warning
+/* The path now names another file (or the old one is gone): finish the
+ * old file, then continue with whatever the path holds now, or with
+ * whatever gets created there. */
+static bool file_rotated( Source *s )
+{
+      bool got = s->fd != -1 && file_drain( s );
+      source_close( s );
+      return file_open( s, false ) || got;
 }
 
-void *pipe_reader_thread( void *arg )
+static bool inotify_readable( void )
 {
-      const char *filename = (const char *)arg;
-      int fd;
+      char buf[ 64 * 1024 ]
+          __attribute__( ( aligned( __alignof__( struct inotify_event ) ) ) );
+      ssize_t n = read( inotify_fd, buf, sizeof buf );
+      if ( n <= 0 )
+            return false;
 
-      while ( 1 )
+      bool got = false;
+      for ( char *p = buf; p < buf + n; )
       {
-            fd = open( filename, O_RDONLY | O_NONBLOCK );
-            if ( fd < 0 )
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof *ev + ev->len;
+
+            for ( int i = 0; i < source_count; ++i )
             {
-                  perror( "pipe open" );
-                  sleep( 1 );
+                  Source *s = &sources[ i ];
+                  if ( s->kind != SRC_FILE )
+                        continue;
+
+                  if ( ev->wd == s->wd )
+                  {
+                        /* a renamed file stays open: its writer may add
+                         * a few lines before reopening the path */
+                        if ( ev->mask & IN_IGNORED )
+                              s->wd = -1;
+                        else if ( ev->mask & IN_DELETE_SELF )
+                              got |= file_rotated( s );
+                        else if ( ev->mask & ( IN_MODIFY | IN_MOVE_SELF ) )
+                              got |= file_drain( s );
+                  }
+                  else if ( ev->wd == s->dir_wd && ev->len &&
+                            strcmp( ev->name, s->base ) == 0 )
+                  {
+                        struct stat st;
+                        if ( stat( s->path, &st ) == 0 &&
+                             ( s->fd == -1 || st.st_ino != s->ino ||
+                               st.st_dev != s->dev ) )
+                              got |= file_rotated( s );
+                  }
+            }
+      }
+      return got;
+}
+
+/* ─── nntmd's shared memory ring (READER shm) ─── */
+/* A daemon started with -M answers "READER ... shm" by passing a memfd
+ * holding the stream in a ring, plus an eventfd, over the socket. Lines
+ * are then copied straight out of the mapping into the LineBuf; the
+ * daemon only writes the eventfd when it finds us asleep, and the socket
+ * is kept just to notice when it goes away. */
+
+#define SHM_MAGIC 0x314d48534d544e4eull /* "NNTMSHM1" */
+#define SHM_SLOTS 256
+
+/* as in nntmd.c */
+typedef struct
+{
+      atomic_uint sleeping;
+      _Atomic uint64_t pos;
+      char pad[ 48 ];
+} ShmSlot;
+
+typedef struct ShmHeader
+{
+      uint64_t magic;
+      uint64_t size; /* of the ring, a power of two */
+      uint64_t data_off;
+      _Atomic uint64_t head;     /* stream offset past the newest line */
+      _Atomic uint64_t reserved; /* bytes before it may be overwritten */
+      char pad[ 24 ];
+      ShmSlot slots[ SHM_SLOTS ];
+} ShmHeader;
+
+/* recvmsg() keeping up to two fds that come with the bytes (-1 if none). */
+static ssize_t recv_fds( int fd, char *buf, size_t len, int fds[ 2 ] )
+{
+      union
+      {
+            struct cmsghdr h;
+            char buf[ CMSG_SPACE( 4 * sizeof( int ) ) ];
+      } u;
+      struct iovec iov  = { buf, len };
+      struct msghdr msg = { .msg_iov        = &iov,
+                            .msg_iovlen     = 1,
+                            .msg_control    = u.buf,
+                            .msg_controllen = sizeof u.buf };
+      ssize_t n = recvmsg( fd, &msg, MSG_CMSG_CLOEXEC );
+      for ( struct cmsghdr *cm = n >= 0 ? CMSG_FIRSTHDR( &msg ) : NULL; cm;
+            cm = CMSG_NXTHDR( &msg, cm ) )
+      {
+            if ( cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS )
                   continue;
+            size_t count = ( cm->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+            for ( size_t i = 0; i < count; ++i )
+            {
+                  int got;
+                  memcpy( &got, CMSG_DATA( cm ) + i * sizeof( int ), sizeof got );
+                  if ( i < 2 && fds[ i ] == -1 )
+                        fds[ i ] = got;
+                  else
+                        close( got );
             }
+      }
+      return n;
+}
+
+static void shm_close_fds( int fds[ 2 ] )
+{
+      for ( int i = 0; i < 2; ++i )
+            if ( fds[ i ] != -1 )
+                  close( fds[ i ] );
+}
+
+/* Maps the ring in fds[ 0 ] and waits on the eventfd in fds[ 1 ], reading
+ * from stream offset `from` on. Takes the fds on success. */
+static bool shm_attach( Source *s, int fds[ 2 ], int slot,
+                        unsigned long long from )
+{
+      struct stat st;
+      if ( slot < 0 || slot >= SHM_SLOTS || fstat( fds[ 0 ], &st ) == -1 ||
+           (size_t)st.st_size < sizeof( ShmHeader ) )
+            return false;
+
+      ShmHeader *h = mmap( NULL, sizeof *h, PROT_READ | PROT_WRITE, MAP_SHARED,
+                           fds[ 0 ], 0 );
+      if ( h == MAP_FAILED )
+            return false;
+      uint64_t size = h->size, off = h->data_off;
+      void *data    = MAP_FAILED;
+      if ( h->magic == SHM_MAGIC && size && !( size & ( size - 1 ) ) &&
+           off >= sizeof *h && (uint64_t)st.st_size >= off + size )
+            data = mmap( NULL, size, PROT_READ, MAP_SHARED, fds[ 0 ], (off_t)off );
+      if ( data == MAP_FAILED )
+      {
+            munmap( h, sizeof *h );
+            return false;
+      }
 
-            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+      struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &s->shm_efd };
+      epoll_ctl( ingest_ep, EPOLL_CTL_ADD, fds[ 1 ], &ev );
+      close( fds[ 0 ] ); /* the mappings stay */
+      s->shm_efd  = fds[ 1 ];
+      s->shm_slot = slot;
+      s->shm_hdr  = h;
+      s->shm_data = data;
+      s->shm_pos  = from;
+      return true;
+}
 
-            char buf[ 512 ];
-            char assembly[ 2 * MAX_LINE ]; /* room for partial tail */
-            size_t asm_len = 0;
+static void shm_detach( Source *s )
+{
+      epoll_ctl( ingest_ep, EPOLL_CTL_DEL, s->shm_efd, NULL );
+      close( s->shm_efd );
+      munmap( (void *)s->shm_data, s->shm_hdr->size );
+      munmap( s->shm_hdr, sizeof *s->shm_hdr );
+      s->shm_efd = -1;
+}
 
-            struct timeval last_ui = { 0 };
+/* The source whose eventfd epoll reported as `ptr`, NULL for any other. */
+static Source *shm_source( void *ptr )
+{
+      for ( int i = 0; i < source_count; ++i )
+            if ( ptr == &sources[ i ].shm_efd )
+                  return &sources[ i ];
+      return NULL;
+}
 
-            while ( 1 )
+/* The daemon went round the ring past us: carries on from the middle of
+ * what it holds, after a marker (a numbered stream marks the gap itself),
+ * dropping the line cut in two. */
+static void shm_lapped( Source *s, uint64_t reserved )
+{
+      LineBuf *lb    = s->lb;
+      uint64_t to    = reserved - s->shm_hdr->size / 2;
+      lb->len        = 0;
+      lb->skipping   = false;
+      if ( !lb->stamped )
+      {
+            int n = snprintf( lb->buf, MAX_LINE,
+                              "@nntmd skipped %llu B (reader too slow)\n",
+                              (unsigned long long)( to - s->shm_pos ) );
+            stream_ingest( lb, (size_t)n, NULL );
+      }
+      lb->skipping = true;
+      s->shm_pos   = to;
+}
+
+/* Copies whatever the daemon has published since the last call into the
+ * LineBuf, STREAM_READ bytes at a time, checking each copy was not being
+ * overwritten meanwhile, and goes to sleep once it has caught up. Takes
+ * no more than a ring's worth per wakeup, so other sources get their turn.
+ * Returns true if lines may have been committed. */
+static bool shm_readable( Source *s )
+{
+      LineBuf *lb   = s->lb;
+      ShmHeader *h  = s->shm_hdr;
+      ShmSlot *slot = &h->slots[ s->shm_slot ];
+      uint64_t size = h->size;
+      bool got      = false;
+      uint64_t v;
+      read( s->shm_efd, &v, sizeof v );
+
+      for ( uint64_t budget = size;; )
+      {
+            uint64_t head =
+                atomic_load_explicit( &h->head, memory_order_acquire );
+            if ( (int64_t)( head - s->shm_pos ) <= 0 )
             {
-                  int ret = poll( &pfd, 1, 1000 );
-                  if ( ret == -1 )
-                  {
-                        perror( "poll" );
-                        break;
-                  }
-                  if ( ret == 0 )
-                        continue; /* timeout */
+                  /* caught up: ask to be woken, unless head moved since */
+                  atomic_store( &slot->sleeping, 1 );
+                  if ( (int64_t)( atomic_load( &h->head ) - s->shm_pos ) <= 0 )
+                        return got;
+                  atomic_store( &slot->sleeping, 0 );
+                  continue;
+            }
+            if ( !budget )
+            {
+                  v = 1; /* back for the rest after the other sources */
+                  write( s->shm_efd, &v, sizeof v );
+                  return got;
+            }
 
-                  if ( pfd.revents & POLLIN )
-                  {
-                        ssize_t n = read( fd, buf, sizeof( buf ) );
-                        if ( n <= 0 )
-                              break;
-
-                        /* 1️⃣  Append the new chunk to ‘assembly’ */
-                        if ( asm_len + n >
-                             sizeof( assembly ) ) /* safety: drop overflow */
-                              n = sizeof( assembly ) - asm_len;
-                        memcpy( assembly + asm_len, buf, n );
-                        asm_len += (size_t)n;
-
-                        /* 2️⃣  Extract every complete line in ‘assembly’ */
-                        size_t start = 0;
-                        for ( ;; )
-                        {
-                              void *nlp = memchr( assembly + start, '\n',
-                                                  asm_len - start );
-                              if ( !nlp )
-                                    break; /* no full line left */
+            uint64_t n = head - s->shm_pos;
+            if ( n > STREAM_READ )
+                  n = STREAM_READ;
+            if ( n > budget )
+                  n = budget;
+            if ( head - s->shm_pos <= size )
+            {
+                  size_t at = s->shm_pos & ( size - 1 );
+                  size_t k  = size - at < n ? size - at : n;
+                  memcpy( lb->buf + lb->len, s->shm_data + at, k );
+                  memcpy( lb->buf + lb->len + k, s->shm_data, n - k );
+            }
+            atomic_thread_fence( memory_order_acquire );
+            uint64_t reserved =
+                atomic_load_explicit( &h->reserved, memory_order_relaxed );
+            if ( reserved - s->shm_pos > size )
+            {
+                  shm_lapped( s, reserved );
+                  got = true;
+                  continue;
+            }
 
-                              size_t len = (char *)nlp - ( assembly + start );
-                              if ( len > 0 && len < MAX_LINE )
-                              {
-                                    assembly[ start + len ] = '\0';
-                                    char *line              = assembly + start;
-
-                                    /* skip blank/whitespace‑only lines */
-                                    while ( *line &&
-                                            isspace( (unsigned char)*line ) )
-                                          ++line;
-                                    if ( *line )
-                                    {
-                                          /* ---------- store the todo
-                                           * ---------- */
-                                          pthread_mutex_lock( &todo_mutex );
-
-                                          if ( todo_count < MAX_TODOS )
-                                          {
-                                                Todo *t = &todos[ todo_count ];
-                                                memset( t, 0, sizeof( Todo ) );
-
-                                                t->completed = false;
-                                                strncpy( t->type, "all",
-                                                         sizeof( t->type ) );
-
-                                                time_t now = time( NULL );
-                                                struct tm *tm =
-                                                    localtime( &now );
-                                                strftime( t->date,
-                                                          sizeof( t->date ),
-                                                          "%Y-%m-%d", tm );
-
-                                                strncpy( t->text, line,
-                                                         MAX_LINE - 1 );
-                                                todo_count++;
-
-                                                if ( auto_scroll_enabled )
-                                                {
-                                                      selected_index =
-                                                          count_visible_items_for_type(
-                                                              types
-                                                                  [ selected_type ] ) -
-                                                          1;
-                                                      scroll_offset =
-                                                          selected_index -
-                                                          ( LINES - 3 );
-                                                      if ( scroll_offset < 0 )
-                                                            scroll_offset = 0;
-                                                }
-                                          }
-
-                                          pthread_mutex_unlock( &todo_mutex );
-                                          /* ------------------------------------
-                                           */
-                                    }
-                              }
+            s->shm_pos += n;
+            atomic_store_explicit( &slot->pos, s->shm_pos,
+                                   memory_order_relaxed );
+            stream_ingest( lb, (size_t)n, s->tag[ 0 ] ? s->tag : NULL );
+            budget -= n;
+            got = true;
+      }
+}
 
-                              start += len + 1; /* step past '\n' */
-                        }
+/* Returns true if opening already committed lines (followed files). */
+static bool source_open( Source *s )
+{
+      if ( s->kind == SRC_FILE )
+            return file_open( s, s->ino == 0 );
 
-                        /* 3️⃣  Move any tail bytes (after last \n) to front */
-                        if ( start < asm_len )
-                        {
-                              memmove( assembly, assembly + start,
-                                       asm_len - start );
-                              asm_len -= start;
-                        }
-                        else
-                        {
-                              asm_len = 0;
-                        }
+      if ( s->kind == SRC_FIFO )
+      {
+            int fd = fifo_open( s->path );
+            if ( fd == -1 )
+            {
+                  s->retry_at = now_ms() + RECONNECT_MS;
+                  return false;
+            }
 
-                        /* 4️⃣  Redraw at most every 50 ms */
-                        struct timeval now_tv;
-                        gettimeofday( &now_tv, NULL );
-                        long diff_ms =
-                            ( now_tv.tv_sec - last_ui.tv_sec ) * 1000 +
-                            ( now_tv.tv_usec - last_ui.tv_usec ) / 1000;
-                        if ( diff_ms > 50 )
-                        {
-                              safe_draw_ui();
-                              last_ui = now_tv;
-                        }
-                  }
-                  else if ( pfd.revents & ( POLLERR | POLLHUP | POLLNVAL ) )
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+            epoll_ctl( ingest_ep, EPOLL_CTL_ADD, fd, &ev );
+            s->fd    = fd;
+            s->state = SRC_LIVE;
+            return false;
+      }
+
+      int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+      if ( fd == -1 )
+      {
+            s->retry_at = now_ms() + RECONNECT_MS;
+            return false;
+      }
+
+      struct sockaddr_un sa = { .sun_family = AF_UNIX };
+      strncpy( sa.sun_path, s->path, sizeof( sa.sun_path ) - 1 );
+
+      /* announce ourselves as reader and ask for as much recent history as
+       * the list holds, or, back from a disconnect from a daemon that
+       * numbers its lines, for everything after the last one we got; a
+       * short line always fits a fresh socket */
+      char hello[ 128 ];
+      int len = s->lb->stamped && s->lb->last_seq
+                    ? snprintf( hello, sizeof hello, "READER since=%llu",
+                                (unsigned long long)s->lb->last_seq + 1 )
+                    : snprintf( hello, sizeof hello, "READER since=-%d",
+                                MAX_TODOS );
+
+      /* headless --type: have the daemon send only that type (and untyped
+       * lines too when they would be tagged with it) */
+      if ( headless_type )
+            len += snprintf( hello + len, sizeof hello - (size_t)len,
+                             " types=%.*s%s", MAX_TYPE, headless_type,
+                             strcmp( s->tag, headless_type ) ? "" : ",all" );
+      else /* a daemon with -M may hand us its ring to read directly */
+            len += snprintf( hello + len, sizeof hello - (size_t)len, " shm" );
+      if ( s->chan[ 0 ] )
+            len += snprintf( hello + len, sizeof hello - (size_t)len,
+                             " chan=%s", s->chan );
+      len += snprintf( hello + len, sizeof hello - (size_t)len, "\n" );
+      if ( connect( fd, (struct sockaddr *)&sa, sizeof sa ) == -1 ||
+           write( fd, hello, (size_t)len ) != len )
+      {
+            close( fd );
+            s->retry_at = now_ms() + RECONNECT_MS;
+            return false;
+      }
+
+      struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+      epoll_ctl( ingest_ep, EPOLL_CTL_ADD, fd, &ev );
+      s->fd    = fd;
+      s->state = SRC_HANDSHAKE;
+      return false;
+}
+
+/* One read() per wakeup keeps busy sources from starving the others;
+ * epoll is level-triggered, so leftovers come back next round. Returns
+ * true if lines may have been committed. */
+static bool source_readable( Source *s )
+{
+      LineBuf *lb = s->lb;
+
+      TRACE_BEGIN( tr );
+      int fds[ 2 ] = { -1, -1 }; /* passed along with the handshake reply */
+      ssize_t n    = s->state == SRC_HANDSHAKE
+                         ? recv_fds( s->fd, lb->buf + lb->len, STREAM_READ, fds )
+                         : read( s->fd, lb->buf + lb->len, STREAM_READ );
+      TRACE_END_ARG( tr, "read", n );
+      if ( n == -1 && ( errno == EAGAIN || errno == EINTR ) )
+            return false;
+      if ( n == 0 && s->kind == SRC_FIFO )
+      {
+            /* last writer gone: swap in a fresh reader before closing the
+             * old one, so the FIFO never has zero readers and a producer
+             * that opens it right now does not get EPIPE */
+            int fd = fifo_open( s->path );
+            if ( fd != -1 )
+            {
+                  epoll_ctl( ingest_ep, EPOLL_CTL_DEL, s->fd, NULL );
+                  close( s->fd );
+                  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+                  epoll_ctl( ingest_ep, EPOLL_CTL_ADD, fd, &ev );
+                  s->fd = fd;
+                  return false;
+            }
+      }
+      if ( n <= 0 )
+      {
+            source_close( s );
+            return false;
+      }
+
+      if ( s->state == SRC_HANDSHAKE )
+      {
+            /* daemon answers "OK\n", or "OK seq\n" if it numbers its lines;
+             * whatever follows it is stream data. "OK[ seq] shm <slot>
+             * <from>" comes with its ring and an eventfd instead. */
+            char *data = lb->buf + lb->len;
+            char *nl   = memchr( data, '\n', (size_t)n );
+            if ( !nl )
+            {
+                  shm_close_fds( fds );
+                  return false;
+            }
+            *nl         = '\0';
+            lb->stamped = !strncmp( data, "OK seq", 6 ) &&
+                          ( !data[ 6 ] || data[ 6 ] == ' ' );
+            const char *o = strstr( data, " shm " );
+            int slot;
+            unsigned long long from;
+            bool shm = o && fds[ 1 ] != -1 &&
+                       sscanf( o, " shm %d %llu", &slot, &from ) == 2 &&
+                       shm_attach( s, fds, slot, from );
+            if ( !shm )
+                  shm_close_fds( fds );
+            n -= nl + 1 - data;
+            memmove( data, nl + 1, (size_t)n );
+            s->state = SRC_LIVE;
+            if ( shm )
+                  return shm_readable( s );
+            if ( !n )
+                  return false;
+      }
+
+      stream_ingest( lb, (size_t)n, s->tag[ 0 ] ? s->tag : NULL );
+      return true;
+}
+
+/* Hands freshly committed lines on: flushed to stdout when headless,
+ * otherwise marked for the next (rate-limited) repaint. */
+static void ingest_committed( bool *dirty )
+{
+      if ( headless )
+            headless_flush();
+      else
+            *dirty = true;
+}
+
+/* Runs forever on the ingest thread with the UI; on the main thread when
+ * headless, until SIGINT/SIGTERM. */
+static void *ingest_loop( void *arg )
+{
+      (void)arg;
+      trace_thread_name( "ingest" );
+
+      struct epoll_event evs[ MAX_SOURCES + 1 ];
+      uint64_t last_ui = 0;
+      bool dirty       = false;
+
+      while ( !stop_ingest )
+      {
+            /* (re)open idle sources that are due, wake for the next one */
+            uint64_t now = now_ms();
+            int timeout  = -1;
+            bool got     = false;
+            for ( int i = 0; i < source_count; ++i )
+            {
+                  Source *s = &sources[ i ];
+                  if ( s->state == SRC_IDLE && s->retry_at <= now )
+                        got |= source_open( s );
+                  if ( s->state != SRC_IDLE )
+                        continue;
+
+                  uint64_t wait = s->retry_at - now;
+                  if ( timeout == -1 || wait < (uint64_t)timeout )
+                        timeout = (int)wait;
+            }
+            if ( got )
+                  ingest_committed( &dirty );
+
+            /* repaint pending data at most every REDRAW_MS */
+            if ( dirty )
+            {
+                  if ( now - last_ui >= REDRAW_MS )
                   {
-                        break; /* pipe closed/error */
+                        safe_draw_ui();
+                        last_ui = now;
+                        dirty   = false;
                   }
+                  else if ( timeout == -1 ||
+                            REDRAW_MS - ( now - last_ui ) < (uint64_t)timeout )
+                        timeout = (int)( REDRAW_MS - ( now - last_ui ) );
             }
-            close( fd );
+
+            int n = epoll_wait( ingest_ep, evs, MAX_SOURCES + 1, timeout );
+            if ( n == -1 && errno != EINTR )
+            {
+                  perror( "epoll_wait" );
+                  exit( 1 );
+            }
+
+            got = false;
+            for ( int i = 0; i < n; ++i )
+            {
+                  void *ptr = evs[ i ].data.ptr;
+                  Source *s = shm_source( ptr );
+                  got |= ptr == &inotify_fd ? inotify_readable()
+                         : s                ? shm_readable( s )
+                                            : source_readable( ptr );
+            }
+            if ( got )
+                  ingest_committed( &dirty );
       }
       return NULL;
 }
@@ -1301,7 +2349,9 @@ static void ui_loop( void )
 
             if ( need_redraw )
             {
+                  TRACE_BEGIN( t0 );
                   draw_ui();
+                  TRACE_END( t0, "draw_ui" );
                   need_redraw = 0;
             }
 
@@ -1312,9 +2362,10 @@ static void ui_loop( void )
             if ( ch == 'q' )
                   break;
 
-            if ( show_help )
+            if ( show_help || show_lag )
             {
                   show_help = false;
+                  show_lag  = false;
                   safe_draw_ui();
                   continue;
             }
@@ -1327,6 +2378,9 @@ static void ui_loop( void )
             case '?':
                   show_help = true;
                   break;
+            case 'L':
+                  show_lag = true;
+                  break;
             case 's':
                   prompt_priority();
                   break;
@@ -1400,6 +2454,8 @@ static void ui_loop( void )
 
             case 'G':
                   // Restore initial order from file read.
+                  if ( streaming_mode )
+                        break;
                   load_todos( todo_filename );
                   selected_index = 0;
                   scroll_offset  = 0;
@@ -1483,38 +2539,109 @@ static void ui_loop( void )
 int main( int argc, char **argv )
 {
 
+      const char *paths[ MAX_SOURCES ];
+      int path_count = 0;
+
       for ( int i = 1; i < argc; ++i )
       {
-            if ( !todo_filename )
-                  todo_filename = argv[ i ];
-            else if ( strcmp( argv[ i ], "--exec" ) == 0 && i + 1 < argc )
+            if ( strcmp( argv[ i ], "--exec" ) == 0 && i + 1 < argc )
                   exec_script = argv[ ++i ];
+            else if ( strcmp( argv[ i ], "--trace" ) == 0 && i + 1 < argc )
+                  trace_path = argv[ ++i ];
+            else if ( strcmp( argv[ i ], "--headless" ) == 0 )
+                  headless = true;
+            else if ( strcmp( argv[ i ], "--json" ) == 0 )
+                  headless_json = true;
+            else if ( strcmp( argv[ i ], "--follow" ) == 0 )
+                  follow_files = true;
+            else if ( strcmp( argv[ i ], "--lines" ) == 0 && i + 1 < argc )
+                  follow_lines = atoi( argv[ ++i ] );
+            else if ( strcmp( argv[ i ], "--type" ) == 0 && i + 1 < argc )
+                  headless_type = argv[ ++i ][ 0 ] == '@' ? argv[ i ] + 1
+                                                          : argv[ i ];
+            else if ( path_count < MAX_SOURCES )
+                  paths[ path_count++ ] = argv[ i ];
       }
 
-      if ( !todo_filename )
+      if ( !path_count )
       {
-            fprintf( stderr, "Usage: %s <todo-file> [-s] [--exec <script>]\n",
-                     argv[ 0 ] );
+            fprintf( stderr,
+                     "Usage: %s <todo-file> [-s] [--exec <script>] "
+                     "[--trace <file>]\n"
+                     "       %s [name=]<socket|fifo>... [--trace <file>]\n"
+                     "       %s --follow [--lines <n>] [name=]<file>...\n"
+                     "       %s --headless [name=]<source>... [--type <type>] "
+                     "[--json]\n",
+                     argv[ 0 ], argv[ 0 ], argv[ 0 ], argv[ 0 ] );
             return 1;
       }
+      todo_filename = paths[ 0 ];
+
+      if ( trace_path )
+      {
+            trace_thread_name( "ui" );
+            atomic_store( &trace_enabled, true );
+            atexit( trace_flush );
+      }
 
       selected_type = 0;
 
-      //-- streaming functionality, if activated by file being pipe
-      if ( is_unix_socket( todo_filename ) )
+      //-- streaming functionality: one or more sockets, FIFOs or followed
+      //   files, all served by the ingest engine (straight to stdout when
+      //   headless)
+      SourceKind kind;
+      streaming_mode = headless || follow_files || path_count > 1 ||
+                       ( source_chan( todo_filename ) &&
+                         access( todo_filename, F_OK ) == -1 ) ||
+                       stream_source_kind( todo_filename, &kind );
+      if ( streaming_mode )
       {
-            streaming_mode        = true;
-            types[ type_count++ ] = strdup( "all" );
+            for ( int i = 0; i < path_count; ++i )
+            {
+                  add_source( paths[ i ], path_count > 1 );
+                  if ( !stream_source_kind( sources[ i ].path,
+                                           &sources[ i ].kind ) )
+                  {
+                        fprintf( stderr,
+                                 follow_files
+                                     ? "%s: not a socket, FIFO or file\n"
+                                     : "%s: not a socket or FIFO\n",
+                                 sources[ i ].path );
+                        return 1;
+                  }
+            }
 
-            // If file does not exist yet, let the thread create the socket
-            if ( !is_unix_socket( todo_filename ) )
-                  unlink( todo_filename ); // safety: delete stale file
+            ingest_ep = epoll_create1( EPOLL_CLOEXEC );
+            if ( ingest_ep == -1 )
+            {
+                  perror( "epoll_create1" );
+                  return 1;
+            }
 
-            pthread_t reader;
-            pthread_create( &reader, NULL, socket_reader_thread,
-                            (void *)todo_filename );
+            if ( follow_files )
+            {
+                  inotify_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+                  if ( inotify_fd == -1 )
+                  {
+                        perror( "inotify_init1" );
+                        return 1;
+                  }
+                  struct epoll_event ev = { .events   = EPOLLIN,
+                                            .data.ptr = &inotify_fd };
+                  epoll_ctl( ingest_ep, EPOLL_CTL_ADD, inotify_fd, &ev );
+            }
+
+            if ( headless )
+            {
+                  struct sigaction sa = { .sa_handler = on_stop };
+                  sigaction( SIGINT, &sa, NULL );
+                  sigaction( SIGTERM, &sa, NULL );
+                  ingest_loop( NULL );
+                  headless_flush();
+                  exit( 0 );
+            }
 
-            pthread_detach( reader );
+            types[ type_count++ ] = strdup( "all" );
       }
       else
       {
@@ -1557,6 +2684,14 @@ int main( int argc, char **argv )
       init_pair( 15, COLOR_BLUE, -1 );    // (E)
       init_pair( 16, COLOR_MAGENTA, -1 ); // (F)
 
+      // sources are read only once the screen and wakeup pipe exist
+      if ( streaming_mode )
+      {
+            pthread_t ingest;
+            pthread_create( &ingest, NULL, ingest_loop, NULL );
+            pthread_detach( ingest );
+      }
+
       safe_draw_ui();
       ui_loop();
 
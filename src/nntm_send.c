@@ -0,0 +1,711 @@
+/* nntm_send – buffered writer library for nntmd, see nntm_send.h
+ * gcc -Wall -O2 -c nntm_send.c
+ */
+#define _GNU_SOURCE
+#include "nntm_send.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/sockios.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEF_SOCK "/tmp/nntm-stream"
+#define DEF_SPOOL_BYTES ( 64 << 20 )
+#define DEF_BUFFER_BYTES ( 1 << 20 )
+#define DEF_BATCH_BYTES ( 64 * 1024 )
+#define DEF_FLUSH_MS 5
+#define HELLO_MAX 256 /* as in nntmd */
+#define HELLO_MS 1000 /* for the daemon's OK */
+#define MIN_BACKOFF_MS 50
+#define MAX_BACKOFF_MS 5000
+#define POLL_MS 100 /* a stalled write looks at `abandon` this often */
+#define SPOOL_CHUNK ( 64 * 1024 ) /* spool bytes per read */
+#define NOTE_MAX 64 /* room kept in a batch for the dropped lines note */
+
+struct NntmSend
+{
+      struct sockaddr_un sa;
+      char hello[ HELLO_MAX ];
+      size_t hello_len;
+      size_t buffer_bytes;
+      size_t batch_bytes;
+      uint64_t flush_ms;
+      size_t spool_bytes;
+      bool block;
+      uint64_t block_ms;
+
+      pthread_t tid;
+      pthread_mutex_t mu;
+      pthread_cond_t wake; /* for the thread: a batch, a flush or close */
+      pthread_cond_t done; /* a pass is over: for nntm_send_flush(), and
+                            * for room in buf with `block` */
+
+      /* under mu: what the callers queued */
+      char *buf;
+      size_t buf_len;
+      uint64_t first_at; /* now_ms() the oldest line in buf came */
+      unsigned long long queued;  /* bytes ever queued */
+      unsigned long long handled; /* of them, sent, spooled or dropped */
+      unsigned long long lost;    /* lines dropped, not noted yet */
+      size_t unacked;             /* inflight_len, for nntm_send_flush() */
+      int flushers;               /* callers in nntm_send_flush() */
+      bool quit;
+      atomic_bool abandon; /* close timed out: stop waiting on the daemon */
+      atomic_ullong down_since; /* now_ms() the daemon was lost, 0 while up */
+
+      /* the thread's own */
+      char *out; /* the batch on its way, swapped with buf */
+      size_t out_len;
+      int fd;            /* -1: not connected */
+      uint64_t next_try; /* now_ms() to connect again at */
+      uint64_t backoff;
+      int spool_fd;       /* -1: no spool */
+      bool spool_pending; /* it may hold lines */
+      char *inflight;       /* written, not yet seen read by the daemon */
+      size_t inflight_len;
+      size_t inflight_cap;
+      size_t inflight_sent;  /* of it, written on this connection */
+      size_t inflight_spool; /* of it, the first bytes, from the spool */
+      uint64_t ack_at;       /* now_ms() to look for reads again at */
+
+      atomic_ullong lines;
+      atomic_ullong bytes;
+      atomic_ullong spooled;
+      atomic_ullong replayed;
+      atomic_ullong dropped;
+      atomic_ullong connects;
+};
+
+#define COUNT( s, field, n )                                                   \
+      atomic_fetch_add_explicit( &( s )->field, ( n ), memory_order_relaxed )
+
+/* ───────────────────────── helpers ───────────────────────── */
+
+static uint64_t now_ms( void )
+{
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static struct timespec deadline( uint64_t ms )
+{
+      return ( struct timespec ){ .tv_sec  = (time_t)( ms / 1000 ),
+                                  .tv_nsec = (long)( ms % 1000 ) * 1000000 };
+}
+
+static unsigned long long count_lines( const char *p, size_t len )
+{
+      unsigned long long n = 0;
+      for ( const char *q = p; ( q = memchr( q, '\n', p + len - q ) ); ++q )
+            ++n;
+      return n;
+}
+
+/* Offset just past the last newline in the first `len` bytes of p, 0 if
+ * there is none. */
+static size_t whole_lines( const char *p, size_t len )
+{
+      const char *nl = memrchr( p, '\n', len );
+      return nl ? (size_t)( nl - p ) + 1 : 0;
+}
+
+/* ─────────────────────── connection ──────────────────────── */
+
+static void sender_drop( NntmSend *s )
+{
+      close( s->fd );
+      s->fd       = -1;
+      s->next_try = now_ms() + s->backoff;
+      atomic_store( &s->down_since, now_ms() );
+}
+
+/* Connects and sends the handshake, backing off further if that fails. */
+static void sender_connect( NntmSend *s )
+{
+      char reply[ 16 ];
+      size_t got = 0;
+      s->fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+      bool ok = s->fd != -1 &&
+                connect( s->fd, (struct sockaddr *)&s->sa, sizeof s->sa ) == 0 &&
+                send( s->fd, s->hello, s->hello_len, MSG_NOSIGNAL ) ==
+                    (ssize_t)s->hello_len;
+
+      /* "OK\n", or a hang-up for a channel it does not take */
+      for ( uint64_t by = now_ms() + HELLO_MS;
+            ok && !memchr( reply, '\n', got ) && got < sizeof reply; )
+      {
+            struct pollfd pfd = { s->fd, POLLIN, 0 };
+            uint64_t now      = now_ms();
+            int ready = now < by ? poll( &pfd, 1, (int)( by - now ) ) : 0;
+            if ( ready == -1 && errno == EINTR )
+                  continue;
+            ssize_t n = ready > 0 ? read( s->fd, reply + got, sizeof reply - got )
+                                  : 0;
+            ok        = n > 0;
+            got += ok ? (size_t)n : 0;
+      }
+      if ( ok && got >= 3 && !memcmp( reply, "OK", 2 ) )
+      {
+            s->backoff = MIN_BACKOFF_MS;
+            atomic_store( &s->down_since, 0 );
+            COUNT( s, connects, 1 );
+            return;
+      }
+
+      if ( s->fd != -1 )
+            sender_drop( s );
+      else
+            s->next_try = now_ms() + s->backoff;
+      s->backoff = s->backoff * 2 < MAX_BACKOFF_MS ? s->backoff * 2
+                                                    : MAX_BACKOFF_MS;
+}
+
+/* Writes p to the daemon. Returns how much of it went; on an error, or a
+ * stall once close has given up, the connection is dropped. */
+static size_t sender_write( NntmSend *s, const char *p, size_t len )
+{
+      size_t done = 0;
+      while ( done < len )
+      {
+            ssize_t w = send( s->fd, p + done, len - done, MSG_NOSIGNAL );
+            if ( w > 0 )
+            {
+                  done += (size_t)w;
+                  continue;
+            }
+            if ( w == -1 && errno == EINTR )
+                  continue;
+            if ( w == -1 && errno == EAGAIN && !atomic_load( &s->abandon ) )
+            {
+                  struct pollfd pfd = { s->fd, POLLOUT, 0 };
+                  poll( &pfd, 1, POLL_MS );
+                  continue;
+            }
+            sender_drop( s );
+            break;
+      }
+      return done;
+}
+
+/* The daemon never sends a writer anything after its OK: if the socket
+ * reads as ready, it has gone away (and the batch goes to the spool
+ * rather than into a socket nobody reads). */
+static bool sender_alive( NntmSend *s )
+{
+      struct pollfd pfd = { s->fd, POLLIN, 0 };
+      if ( poll( &pfd, 1, 0 ) == 0 )
+            return true;
+      sender_drop( s );
+      return false;
+}
+
+/* Keeps a copy of what was just written until the daemon has read it. */
+static void inflight_add( NntmSend *s, const char *p, size_t len, bool spool )
+{
+      if ( s->inflight_len + len > s->inflight_cap )
+      {
+            size_t cap = s->inflight_cap ? s->inflight_cap : SPOOL_CHUNK;
+            while ( cap < s->inflight_len + len )
+                  cap *= 2;
+            char *n = realloc( s->inflight, cap );
+            if ( !n )
+                  abort();
+            s->inflight     = n;
+            s->inflight_cap = cap;
+      }
+      if ( spool && s->inflight_spool == s->inflight_len )
+            s->inflight_spool += len;
+      memcpy( s->inflight + s->inflight_len, p, len );
+      s->inflight_len += len;
+      s->inflight_sent += len;
+}
+
+/* Counts the whole lines the daemon has read from the socket as sent and
+ * lets go of them. SIOCOUTQ is what it has not read yet, in the kernel's
+ * own accounting (so never less). It reads 0 once the daemon's end is
+ * closed, so it is believed only if the socket has not hung up since. */
+static void sender_acked( NntmSend *s )
+{
+      int unread;
+      if ( !s->inflight_sent ||
+           ioctl( s->fd, SIOCOUTQ, &unread ) == -1 || !sender_alive( s ) )
+            return;
+
+      size_t sent = s->inflight_sent;
+      size_t read = sent > (size_t)unread ? sent - (size_t)unread : 0;
+      size_t full = whole_lines( s->inflight, read );
+      if ( !full )
+            return;
+      size_t spool = full < s->inflight_spool ? full : s->inflight_spool;
+      COUNT( s, replayed, count_lines( s->inflight, spool ) );
+      COUNT( s, lines, count_lines( s->inflight, full ) );
+      COUNT( s, bytes, full );
+      s->inflight_spool -= spool;
+      s->inflight_sent -= full;
+      s->inflight_len -= full;
+      memmove( s->inflight, s->inflight + full, s->inflight_len );
+}
+
+/* ───────────────────────── spool ─────────────────────────── */
+
+/* Appends the batch's whole lines that fit under spool_bytes; drops the
+ * rest. The spool is not O_APPEND (spool_cut moves bytes within it), so
+ * the end is taken under the lock. */
+static void spool_append( NntmSend *s )
+{
+      flock( s->spool_fd, LOCK_EX );
+      struct stat st;
+      size_t size = fstat( s->spool_fd, &st ) == 0 ? (size_t)st.st_size : 0;
+      size_t room = size < s->spool_bytes ? s->spool_bytes - size : 0;
+      size_t n    = s->out_len <= room ? s->out_len : whole_lines( s->out, room );
+      size_t done = 0;
+      while ( done < n )
+      {
+            ssize_t w = pwrite( s->spool_fd, s->out + done, n - done,
+                                (off_t)( size + done ) );
+            if ( w == -1 && errno == EINTR )
+                  continue;
+            if ( w <= 0 )
+                  break;
+            done += (size_t)w;
+      }
+      if ( done < n ) /* disk full: not even the part of a line */
+      {
+            done = whole_lines( s->out, done );
+            if ( ftruncate( s->spool_fd, (off_t)( size + done ) ) == -1 )
+                  done = n; /* ... or it stays, cut */
+      }
+      flock( s->spool_fd, LOCK_UN );
+
+      unsigned long long lost = count_lines( s->out + done, s->out_len - done );
+      COUNT( s, spooled, count_lines( s->out, done ) );
+      COUNT( s, dropped, lost );
+      if ( lost )
+      {
+            pthread_mutex_lock( &s->mu );
+            s->lost += lost;
+            pthread_mutex_unlock( &s->mu );
+      }
+      s->spool_pending |= done != 0;
+      s->out_len = 0;
+}
+
+/* Removes the first `cut` bytes of the spool (already sent). */
+static void spool_cut( NntmSend *s, off_t cut )
+{
+      char chunk[ SPOOL_CHUNK ];
+      off_t at = cut;
+      ssize_t n;
+      while ( ( n = pread( s->spool_fd, chunk, sizeof chunk, at ) ) > 0 &&
+              pwrite( s->spool_fd, chunk, (size_t)n, at - cut ) == n )
+            at += n;
+      if ( n != 0 )
+            return; /* not all of it moved: left longer, not shorter */
+      if ( ftruncate( s->spool_fd, at - cut ) == -1 )
+            return; /* sent again next time */
+}
+
+/* Puts the `len` bytes at p in front of what the spool holds. */
+static bool spool_prepend( NntmSend *s, const char *p, size_t len )
+{
+      char chunk[ SPOOL_CHUNK ];
+      struct stat st;
+      flock( s->spool_fd, LOCK_EX );
+      bool ok    = fstat( s->spool_fd, &st ) == 0;
+      off_t size = ok ? st.st_size : 0;
+      for ( off_t at = size; ok && at > 0; )
+      {
+            size_t n = at < (off_t)sizeof chunk ? (size_t)at : sizeof chunk;
+            at -= (off_t)n;
+            ok = pread( s->spool_fd, chunk, n, at ) == (ssize_t)n &&
+                 pwrite( s->spool_fd, chunk, n, at + (off_t)len ) ==
+                     (ssize_t)n;
+            if ( !ok && at + (off_t)n == size ) /* nothing moved yet */
+                  if ( ftruncate( s->spool_fd, size ) == -1 )
+                        ok = false;
+      }
+      ok = ok && pwrite( s->spool_fd, p, len, 0 ) == (ssize_t)len;
+      flock( s->spool_fd, LOCK_UN );
+      return ok;
+}
+
+/* Sends what the spool holds and takes the whole lines that went out of
+ * it: from then on they are in inflight, until the daemon has read them.
+ * If the connection breaks (or the spool cannot be read) on the way, the
+ * rest stays. */
+static void spool_replay( NntmSend *s )
+{
+      char chunk[ SPOOL_CHUNK ];
+      off_t off  = 0;
+      off_t sent = 0; /* past the last whole line sent */
+      struct stat st;
+      flock( s->spool_fd, LOCK_EX );
+      for ( ;; )
+      {
+            ssize_t n = pread( s->spool_fd, chunk, sizeof chunk, off );
+            if ( n == -1 && errno == EINTR )
+                  continue;
+            if ( n <= 0 )
+                  break;
+            size_t w    = sender_write( s, chunk, (size_t)n );
+            size_t full = whole_lines( chunk, w );
+            inflight_add( s, chunk, w, true );
+            if ( full )
+                  sent = off + (off_t)full;
+            off += (off_t)w;
+            if ( w < (size_t)n )
+                  break;
+            sender_acked( s );
+            if ( s->fd == -1 )
+                  break;
+      }
+      if ( sent )
+            spool_cut( s, sent );
+      s->spool_pending = fstat( s->spool_fd, &st ) == -1 || st.st_size > 0;
+      flock( s->spool_fd, LOCK_UN );
+}
+
+/* ───────────────────────── thread ────────────────────────── */
+
+/* The connection is gone: what the daemon was not seen to read is sent
+ * again, before anything else. With a spool it goes back in front of it;
+ * without, it stays in inflight for the next connection. A line cut short
+ * is still where it came from (out or the spool), whole. */
+static void sender_requeue( NntmSend *s )
+{
+      s->inflight_len   = whole_lines( s->inflight, s->inflight_len );
+      s->inflight_sent  = 0;
+      s->inflight_spool = 0;
+      if ( s->spool_fd == -1 || !s->inflight_len )
+            return;
+      unsigned long long lines = count_lines( s->inflight, s->inflight_len );
+      if ( spool_prepend( s, s->inflight, s->inflight_len ) )
+      {
+            COUNT( s, spooled, lines );
+            s->spool_pending = true;
+      }
+      else
+      {
+            COUNT( s, dropped, lines );
+            pthread_mutex_lock( &s->mu );
+            s->lost += lines;
+            pthread_mutex_unlock( &s->mu );
+      }
+      s->inflight_len = 0;
+}
+
+/* Sends the batch in out (after whatever is to be sent again, and the
+ * spool, if it has lines), else spools it; on the way out (quit) drops
+ * whatever could go nowhere. */
+static void sender_pass( NntmSend *s, bool quit )
+{
+      if ( s->fd == -1 &&
+           ( s->out_len || s->spool_pending || s->inflight_len ) &&
+           now_ms() >= s->next_try && !atomic_load( &s->abandon ) )
+            sender_connect( s );
+      if ( s->fd != -1 && s->inflight_sent < s->inflight_len &&
+           sender_alive( s ) )
+            s->inflight_sent +=
+                sender_write( s, s->inflight + s->inflight_sent,
+                              s->inflight_len - s->inflight_sent );
+      if ( s->fd != -1 && s->spool_pending && sender_alive( s ) )
+            spool_replay( s );
+      if ( s->fd != -1 && s->out_len && sender_alive( s ) )
+      {
+            size_t w    = sender_write( s, s->out, s->out_len );
+            size_t full = w == s->out_len ? w : whole_lines( s->out, w );
+            inflight_add( s, s->out, w, false );
+            s->out_len -= full;
+            memmove( s->out, s->out + full, s->out_len );
+      }
+      if ( s->fd != -1 )
+            sender_acked( s );
+      if ( s->fd == -1 && s->inflight_len )
+            sender_requeue( s );
+      if ( s->fd == -1 && s->out_len && s->spool_fd != -1 )
+            spool_append( s );
+      if ( quit && s->out_len )
+      {
+            COUNT( s, dropped, count_lines( s->out, s->out_len ) );
+            s->out_len = 0;
+      }
+}
+
+/* Waits, with mu held, until there is something to do: a full batch, a
+ * flush, the oldest line's time, a connection to retry, or close. */
+static void sender_wait( NntmSend *s )
+{
+      for ( ;; )
+      {
+            uint64_t now = now_ms();
+            uint64_t due = UINT64_MAX;
+            /* on close, only the daemon's reading may be left to wait for */
+            if ( s->quit && ( s->buf_len || s->out_len || s->fd == -1 ||
+                              !s->inflight_len ||
+                              atomic_load( &s->abandon ) ) )
+                  return;
+            if ( s->buf_len && ( s->fd != -1 || s->spool_fd != -1 ) )
+                  due = s->flushers || s->buf_len >= s->batch_bytes
+                            ? now
+                            : s->first_at + s->flush_ms;
+            if ( s->fd == -1 &&
+                 ( s->buf_len || s->out_len || s->spool_pending ||
+                   s->inflight_len ) &&
+                 s->next_try < due )
+                  due = s->next_try;
+            if ( s->fd != -1 && s->inflight_len && s->ack_at < due )
+                  due = s->ack_at;
+            if ( due <= now )
+                  return;
+            if ( due == UINT64_MAX )
+                  pthread_cond_wait( &s->wake, &s->mu );
+            else
+            {
+                  struct timespec ts = deadline( due );
+                  pthread_cond_timedwait( &s->wake, &s->mu, &ts );
+            }
+      }
+}
+
+static void *sender_main( void *arg )
+{
+      NntmSend *s = arg;
+      sender_connect( s ); /* and send a spool left from before */
+      if ( s->fd != -1 && s->spool_pending )
+            spool_replay( s );
+
+      pthread_mutex_lock( &s->mu );
+      while ( !s->quit || s->buf_len || s->out_len ||
+              ( s->inflight_len && s->fd != -1 &&
+                !atomic_load( &s->abandon ) ) )
+      {
+            sender_wait( s );
+            if ( !s->out_len )
+            {
+                  char *t    = s->out;
+                  s->out     = s->buf;
+                  s->out_len = s->buf_len;
+                  s->buf     = t;
+                  s->buf_len = 0;
+                  if ( s->lost && s->out_len )
+                  {
+                        /* where the stream has a hole, as nntmd marks its
+                         * own */
+                        int n = snprintf( s->out + s->out_len, NOTE_MAX,
+                                          "@nntm-send %llu lines dropped\n",
+                                          s->lost );
+                        s->out_len += (size_t)n;
+                        s->queued += (unsigned long long)n;
+                        s->lost = 0;
+                  }
+            }
+            bool quit  = s->quit;
+            size_t had = s->out_len;
+            pthread_mutex_unlock( &s->mu );
+
+            sender_pass( s, quit );
+            s->ack_at = now_ms() + s->flush_ms;
+
+            pthread_mutex_lock( &s->mu );
+            s->handled += had - s->out_len;
+            s->unacked = s->inflight_len;
+            pthread_cond_broadcast( &s->done );
+      }
+      pthread_mutex_unlock( &s->mu );
+
+      /* closed before the daemon was seen to read it all: into the spool
+       * (perhaps to be sent twice), or lost */
+      if ( s->inflight_len )
+      {
+            sender_requeue( s );
+            COUNT( s, dropped, count_lines( s->inflight, s->inflight_len ) );
+      }
+      return NULL;
+}
+
+/* ────────────────────────── API ──────────────────────────── */
+
+NntmSend *nntm_send_open( const NntmSendOptions *opt )
+{
+      static const NntmSendOptions none;
+      if ( !opt )
+            opt = &none;
+      const char *path = opt->sock_path ? opt->sock_path : DEF_SOCK;
+      if ( strlen( path ) >= sizeof( ( struct sockaddr_un ){ 0 }.sun_path ) )
+      {
+            errno = ENAMETOOLONG;
+            return NULL;
+      }
+
+      NntmSend *s = calloc( 1, sizeof *s );
+      if ( !s )
+            return NULL;
+      s->sa.sun_family = AF_UNIX;
+      strcpy( s->sa.sun_path, path );
+      int n = snprintf( s->hello, sizeof s->hello, "WRITER%s%s\n",
+                        opt->chan ? " chan=" : "",
+                        opt->chan ? opt->chan : "" );
+      s->hello_len    = (size_t)n < sizeof s->hello ? (size_t)n : 0;
+      s->buffer_bytes = opt->buffer_bytes ? opt->buffer_bytes : DEF_BUFFER_BYTES;
+      s->batch_bytes  = opt->batch_bytes ? opt->batch_bytes : DEF_BATCH_BYTES;
+      s->flush_ms     = opt->flush_ms > 0 ? (uint64_t)opt->flush_ms : DEF_FLUSH_MS;
+      s->spool_bytes  = opt->spool_bytes ? opt->spool_bytes : DEF_SPOOL_BYTES;
+      s->block        = opt->block;
+      s->block_ms     = opt->block_ms > 0 ? (uint64_t)opt->block_ms : 0;
+      s->down_since   = now_ms(); /* until the thread connects */
+      s->fd           = -1;
+      s->spool_fd     = -1;
+      s->backoff      = MIN_BACKOFF_MS;
+      s->buf          = malloc( s->buffer_bytes + NOTE_MAX );
+      s->out          = malloc( s->buffer_bytes + NOTE_MAX );
+      if ( !s->hello_len )
+            errno = EINVAL;
+      if ( !s->hello_len || !s->buf || !s->out )
+            goto fail;
+
+      if ( opt->spool_path )
+      {
+            s->spool_fd = open( opt->spool_path,
+                                O_RDWR | O_CREAT | O_CLOEXEC, 0600 );
+            struct stat st;
+            if ( s->spool_fd == -1 || fstat( s->spool_fd, &st ) == -1 )
+                  goto fail;
+            s->spool_pending = st.st_size > 0;
+      }
+
+      pthread_condattr_t ca;
+      pthread_condattr_init( &ca );
+      pthread_condattr_setclock( &ca, CLOCK_MONOTONIC );
+      pthread_mutex_init( &s->mu, NULL );
+      pthread_cond_init( &s->wake, &ca );
+      pthread_cond_init( &s->done, &ca );
+      pthread_condattr_destroy( &ca );
+      errno = pthread_create( &s->tid, NULL, sender_main, s );
+      if ( !errno )
+            return s;
+      pthread_mutex_destroy( &s->mu );
+      pthread_cond_destroy( &s->wake );
+      pthread_cond_destroy( &s->done );
+
+fail:;
+      int err = errno;
+      if ( s->spool_fd != -1 )
+            close( s->spool_fd );
+      free( s->buf );
+      free( s->out );
+      free( s );
+      errno = err;
+      return NULL;
+}
+
+int nntm_send_line( NntmSend *s, const char *line, size_t len )
+{
+      bool nl     = len && line[ len - 1 ] == '\n';
+      size_t need = len + !nl;
+      pthread_mutex_lock( &s->mu );
+      while ( s->block && need <= s->buffer_bytes &&
+              s->buf_len + need > s->buffer_bytes )
+      {
+            /* with no spool to take them, lines wait for a daemon that is
+             * down only block_ms */
+            uint64_t down = atomic_load( &s->down_since );
+            if ( !s->block_ms || s->spool_fd != -1 || !down )
+                  pthread_cond_wait( &s->done, &s->mu );
+            else if ( now_ms() < down + s->block_ms )
+            {
+                  struct timespec ts = deadline( down + s->block_ms );
+                  pthread_cond_timedwait( &s->done, &s->mu, &ts );
+            }
+            else
+                  break;
+      }
+      if ( s->buf_len + need > s->buffer_bytes )
+      {
+            ++s->lost;
+            pthread_mutex_unlock( &s->mu );
+            COUNT( s, dropped, 1 );
+            return -1;
+      }
+
+      /* the thread sleeps for good while buf is empty */
+      bool kick = !s->buf_len || ( s->buf_len < s->batch_bytes &&
+                                   s->buf_len + need >= s->batch_bytes );
+      if ( !s->buf_len )
+            s->first_at = now_ms();
+      memcpy( s->buf + s->buf_len, line, len );
+      if ( !nl )
+            s->buf[ s->buf_len + len ] = '\n';
+      s->buf_len += need;
+      s->queued += need;
+      pthread_mutex_unlock( &s->mu );
+      if ( kick )
+            pthread_cond_signal( &s->wake );
+      return 0;
+}
+
+int nntm_send_flush( NntmSend *s, int timeout_ms )
+{
+      struct timespec ts = deadline( now_ms() + (uint64_t)timeout_ms );
+      pthread_mutex_lock( &s->mu );
+      unsigned long long target = s->queued;
+      ++s->flushers;
+      pthread_cond_signal( &s->wake );
+      int rc = 0;
+      while ( ( s->handled < target || s->unacked ) && !rc )
+            rc = timeout_ms < 0 ? pthread_cond_wait( &s->done, &s->mu )
+                                : pthread_cond_timedwait( &s->done, &s->mu, &ts );
+      --s->flushers;
+      bool ok = s->handled >= target && !s->unacked;
+      pthread_mutex_unlock( &s->mu );
+      return ok ? 0 : -1;
+}
+
+void nntm_send_stats( NntmSend *s, NntmSendStats *st )
+{
+      st->lines    = atomic_load( &s->lines );
+      st->bytes    = atomic_load( &s->bytes );
+      st->spooled  = atomic_load( &s->spooled );
+      st->replayed = atomic_load( &s->replayed );
+      st->dropped  = atomic_load( &s->dropped );
+      st->connects = atomic_load( &s->connects );
+}
+
+void nntm_send_close( NntmSend *s, int timeout_ms, NntmSendStats *st )
+{
+      if ( nntm_send_flush( s, timeout_ms ) == -1 )
+            atomic_store( &s->abandon, true );
+      pthread_mutex_lock( &s->mu );
+      s->quit = true;
+      pthread_cond_signal( &s->wake );
+      pthread_mutex_unlock( &s->mu );
+      pthread_join( s->tid, NULL );
+      if ( st )
+            nntm_send_stats( s, st );
+
+      if ( s->fd != -1 )
+            close( s->fd );
+      if ( s->spool_fd != -1 )
+            close( s->spool_fd );
+      pthread_mutex_destroy( &s->mu );
+      pthread_cond_destroy( &s->wake );
+      pthread_cond_destroy( &s->done );
+      free( s->buf );
+      free( s->out );
+      free( s->inflight );
+      free( s );
+}
@@ -0,0 +1,73 @@
+/* nntm_send – buffered writer library for nntmd
+ *
+ * Lines given to nntm_send_line() are copied into a buffer and written to
+ * the daemon in large batches by a thread of the sender's own, over one
+ * connection that is kept open, and opened again with backoff when the
+ * daemon goes away. While the daemon cannot be reached, batches go to a
+ * spool file of bounded size instead. The spool is sent first on the next
+ * connection, by this sender or by the next one that uses the same file.
+ * The caller never waits on the daemon: a line that finds the buffer full
+ * is dropped and counted, unless the sender was opened to block instead.
+ *
+ * A line counts as sent once the daemon has read it from the socket (the
+ * kernel's count of unread bytes, SIOCOUTQ, says so); until then the
+ * sender keeps a copy, and sends it again, ahead of anything newer, if
+ * the connection is lost. Delivery is at least once: lines the daemon
+ * read just before the connection broke may be sent twice. A line it had
+ * read but not yet passed on when it died is lost.
+ */
+#ifndef NNTM_SEND_H
+#define NNTM_SEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct NntmSend NntmSend;
+
+typedef struct
+{
+      const char *sock_path;  /* NULL: /tmp/nntm-stream */
+      const char *chan;       /* NULL: the default channel */
+      const char *spool_path; /* NULL: no spool, lines wait in the buffer */
+      size_t spool_bytes;     /* 0: 64 MiB */
+      size_t buffer_bytes;    /* 0: 1 MiB */
+      size_t batch_bytes;     /* written as soon as this much is in; 0: 64 KiB */
+      int flush_ms;           /* ... or once the oldest line is this old; 0: 5 */
+      bool block; /* a line that finds the buffer full waits for room */
+      int block_ms; /* ... but with no spool, only this long after the
+                     * daemon was lost; 0: for good */
+} NntmSendOptions;
+
+typedef struct
+{
+      unsigned long long lines; /* sent to the daemon, spool included */
+      unsigned long long bytes;
+      unsigned long long spooled; /* lines written to the spool */
+      unsigned long long replayed; /* lines sent from the spool */
+      unsigned long long dropped; /* lines lost: buffer or spool full */
+      unsigned long long connects;
+} NntmSendStats;
+
+/* Starts a sender; `opt` may be NULL for the defaults. Returns NULL, with
+ * errno set, if the spool cannot be opened or the thread not started. */
+NntmSend *nntm_send_open( const NntmSendOptions *opt );
+
+/* Queues one line (a newline is added if it has none). Returns 0, or -1 if
+ * it was dropped because the buffer is full (or, with `block`, because it
+ * is longer than the buffer). Safe to call from several threads. */
+int nntm_send_line( NntmSend *s, const char *line, size_t len );
+
+/* Waits up to timeout_ms (-1: for good) until every line queued so far is
+ * in the spool, or read by the daemon along with all sent before it.
+ * Returns 0, or -1 on timeout. */
+int nntm_send_flush( NntmSend *s, int timeout_ms );
+
+/* Counters so far. */
+void nntm_send_stats( NntmSend *s, NntmSendStats *st );
+
+/* Flushes as nntm_send_flush() does, then spools (or drops) whatever is
+ * left, stops the thread and frees s, leaving the final counters in *st
+ * if st is not NULL. */
+void nntm_send_close( NntmSend *s, int timeout_ms, NntmSendStats *st );
+
+#endif
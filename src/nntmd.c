@@ -1,56 +1,494 @@
 /* nntmd – multiplexer daemon for nntm
  * gcc -Wall -O2 -o nntmd nntmd.c
  */
+#define _GNU_SOURCE
+#include <dirent.h>
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_CLIENTS 64
-#define BUF_SIZE 512
+#define DEF_MAX_CLIENTS 4096
+#define DEF_QUEUE_LIMIT ( 1 << 20 )
+#define BUF_SIZE ( 64 * 1024 ) /* per read() from a writer */
+#define DEF_LINE_LIMIT BUF_SIZE
+#define DEF_BACKLOG_LINES 10000
+#define DEF_BACKLOG_BYTES ( 4 << 20 )
+#define HELLO_MAX 256 /* longest handshake line */
+#define DEF_HELLO_MS 5000
+#define DEF_LISTEN_BACKLOG 1024
+#define MAX_ACCEPT 64 /* connections taken per wakeup */
+#define MAX_PACKETS 64 /* messages per recvmmsg */
+#define PACKET_BUF ( 1 << 20 )
+#define MAX_EVENTS 256
+#define SEG_SIZE ( 64 * 1024 )
+#define MAX_IOV 16     /* segments (~1 MiB) per writev */
+#define FILTER_IOV 256 /* line ranges per writev to a subscribed reader */
+#define MAX_KEEP 4096  /* partly sent line finished before a gap marker */
+#define DEF_COALESCE_MS 1
+#define DEF_LOG_SEG_BYTES ( 64 << 20 )
+#define DEF_LOG_MAX_BYTES ( 1LL << 30 )
+#define DEF_LOG_FSYNC_MS 100
+#define INDEX_STRIDE ( 64 * 1024 ) /* log bytes per sparse index entry */
+#define CATCHUP_CHUNK ( 1 << 20 )  /* log bytes sent per wakeup */
+#define REC_HDR_MAX 48 /* room for a "<seq>:<ns>\t" record header */
+#define MAX_TYPE 32  /* as in nntm: longer @types count as none */
+#define MAX_TYPES 4096
+#define TYPE_SLOTS ( 2 * MAX_TYPES )
+#define TYPE_ALL 0                  /* lines without an @type */
+#define TYPE_OTHER ( MAX_TYPES - 1 ) /* any type beyond the table */
+#define MAX_WORKERS 64
+#define INBOX_SIZE 1024 /* readers waiting to be taken by a worker */
+#define SHM_MAGIC 0x314d48534d544e4eull /* "NNTMSHM1" */
+#define SHM_SLOTS 256 /* readers of the shared memory ring */
+#define SHM_MIN ( 64 * 1024 )
 #define DEF_SOCK "/tmp/nntm-stream"
+#define ROUND_BYTES ( 256 * 1024 ) /* writer input per pass of the loop */
+#define MIN_SHARE 4096             /* ... but at least this per writer */
+#define HOLD_BYTES 4096 /* a held writer is read again once it may send this */
+#define DEF_VERBOSE_RATE 100 /* -v messages per second */
+#define HIST_BUCKETS 24      /* loop times by powers of two, in µs */
+#define MAX_CHAN 32          /* longest channel name, with its NUL */
+#define MAX_CHANNELS 256
+#define HANDOFF_ENV "NNTMD_HANDOFF" /* set for the new process of a restart */
+#define HANDOFF_MAGIC 0x31464f484d544e4eull /* "NNTMHOF1" */
+#define HANDOFF_FDS 5     /* descriptors per message, at most */
+#define HANDOFF_MS 10000  /* for the new process to take over */
+
+/* What happens when a reader falls more than the limit behind */
+typedef enum
+{
+      OVF_DROP,       /* skip its oldest unsent lines, insert a gap marker */
+      OVF_DISCONNECT, /* hang up on it */
+      OVF_BLOCK       /* stop reading writers until it catches up */
+} Overflow;
 
 typedef struct
 {
       int fd;
       bool is_reader;
-      bool active;
+      int slot; /* index in pending[] / readers[] / writers[] (or its
+                 * worker's) */
+
+      /* a new connection, until its first line shows what it is */
+      char *hello; /* HELLO_MAX bytes, NULL once it is known */
+      size_t hello_len;
+      uint64_t hello_by; /* now_ms() it is given up on by */
+      struct Worker *w; /* serving it with -t, NULL: the main loop */
+
+      /* reader: position in the broadcast ring, plus bytes of its own
+       * (gap markers) to send before it */
+      struct Segment *seg;
+      uint64_t cursor;
+      char *pend;
+      size_t pend_len;
+      size_t pend_cap;
+      bool out_armed; /* behind, waiting for EPOLLOUT */
+      bool mid_line;  /* the last byte sent was not a newline */
+      bool blocking;  /* over the limit, holding writers back (OVF_BLOCK) */
+      char *subs;      /* types=..., NULL for every line */
+      uint64_t *wants; /* bit per type id, NULL for every line */
+
+      /* reader of the shared memory ring (-M): sent nothing on its socket,
+       * only woken through shm_efd when it sleeps */
+      bool shm;
+      int shm_slot;
+      int shm_efd;
+
+      /* reader with -Z: its queue is a pipe, filled by tee() and spliced
+       * on to its socket */
+      int pipe_fd[ 2 ]; /* -1 when not relaying */
+      size_t pipe_len;
+
+      /* reader resuming from the log: sent from disk (seg is NULL) until
+       * it reaches the end of the newest file, then joins the ring */
+      int disk_fd; /* -1 when not catching up */
+      uint64_t disk_seq; /* first_seq of the file being sent */
+      off_t disk_off;
+
+      struct Channel *ch; /* whose ring it reads or writes to */
+
+      /* writer: the line it has not finished yet */
+      char *part;
+      size_t part_len;
+      size_t part_cap;
+      bool skipping; /* rest of an over-long line */
+      bool packets;  /* on the SOCK_SEQPACKET socket: a line per message */
+
+      /* writer rate limit (-r): a bucket of `burst` bytes that fills at
+       * `rate` bytes a second, held unread while it refills (-O pause) */
+      size_t rate; /* 0: unlimited */
+      size_t burst;
+      int64_t tokens;
+      uint64_t filled_at; /* now_us() */
+      bool held;
+      uint64_t held_at; /* now_ms() */
+      uint64_t held_until;
+      uint64_t noted_at; /* now_ms() of its last summary line */
+      unsigned long long unnoted_ms;
+      unsigned long long unnoted_lines;
+
+      /* reader counters */
+      unsigned long long sent;
+      unsigned long long writes; /* writev calls */
+      unsigned long long dropped_lines;
+      unsigned long long gaps;
+      size_t max_lag;
+
+      /* writer counters */
+      unsigned long long bytes_in;
+      unsigned long long lines_in;
+      unsigned long long long_lines;
+      unsigned long long held_ms;
+      unsigned long long rate_dropped; /* lines over its rate (-O drop) */
+
+      /* control socket connection (-C): sent its dump from pend, then
+       * hung up on; in none of the lists */
+      bool ctl;
 } Client;
 
-static Client clients[ MAX_CLIENTS ];
-static int srv_fd         = -1;
-static bool verbose       = false;
-static size_t num_readers = 0;
-static size_t num_writers = 0;
+typedef struct Segment
+{
+      struct Segment *_Atomic next;
+      uint64_t start; /* stream offset of data[ 0 ] */
+      size_t len;     /* only the main loop may look at it */
+      atomic_int refs; /* readers whose cursor lies in this segment */
+      char data[ SEG_SIZE ];
+} Segment;
+
+typedef struct
+{
+      uint64_t off; /* stream offset where the line starts */
+      uint32_t type;
+} LineRec;
+
+/* A stream of its own (chan=<name> in the handshake): ring, line index,
+ * numbering and counters. The default one is named ""; only it goes to
+ * the log (-d), the shared ring (-M) or the relay (-Z). */
+typedef struct Channel
+{
+      char name[ MAX_CHAN ];
+      Segment *ring_head;
+      Segment *ring_tail;
+      uint64_t ring_end; /* stream offset past the newest byte */
+      bool ring_mid;     /* the newest byte is not a newline */
+      /* ring_end as the workers may see it, stored (release) once the
+       * bytes before it are in */
+      _Atomic uint64_t ring_pub;
+      uint64_t fanned_end; /* ring_end at the last fanout */
+
+      /* line index: a ring of LineRecs, recs_cap a power of two */
+      LineRec *recs;
+      size_t recs_cap;
+      size_t recs_first;
+      size_t num_recs;
+
+      /* records of the batch being ingested (-d, -T), see emit() */
+      char *stage;
+      size_t stage_len;
+      size_t stage_cap;
+      uint64_t stage_seq; /* number of its first record */
+      bool stage_mid;     /* its last byte is not a newline */
+      uint64_t next_seq;
+
+      atomic_size_t readers; /* workers count theirs out */
+      size_t writers;
+      atomic_size_t blocking; /* readers holding its writers back (-o block) */
+      bool paused;            /* ... and so they are not read */
+      atomic_ullong bytes_in;
+      atomic_ullong lines_in;
+      atomic_ullong dropped_lines;
+} Channel;
+
+/* Layout of the shared memory ring (-M), as in nntm: this header, then
+ * `size` bytes of stream from data_off on, byte `off` of the stream being
+ * at data_off + ( off & ( size - 1 ) ). */
+typedef struct
+{
+      atomic_uint sleeping;  /* set by the reader before it waits */
+      _Atomic uint64_t pos;  /* set by the reader: how far it has read */
+      char pad[ 48 ];        /* a cache line per reader */
+} ShmSlot;
+
+typedef struct
+{
+      uint64_t magic;
+      uint64_t size;              /* a power of two */
+      uint64_t data_off;
+      _Atomic uint64_t head;      /* stream offset past the newest line */
+      _Atomic uint64_t reserved;  /* bytes before it may be overwritten */
+      char pad[ 24 ];
+      ShmSlot slots[ SHM_SLOTS ];
+} ShmHeader;
+
+/* Always-on totals, bumped from the main loop and the workers alike (so
+ * relaxed atomics), for the control socket (-C). */
+typedef struct
+{
+      atomic_ullong accepts;
+      atomic_ullong refused;        /* over max_clients */
+      atomic_ullong hello_timeouts; /* gave up on a half handshake */
+      atomic_ullong hello_too_long;
+      atomic_ullong bytes_in;
+      atomic_ullong lines_in;
+      atomic_ullong long_lines;  /* cut at line_limit */
+      atomic_ullong read_eagain; /* woken for a writer with nothing to read */
+      atomic_ullong bytes_out;
+      atomic_ullong writes;       /* writev / sendfile / splice calls */
+      atomic_ullong write_eagain; /* a reader's socket was full */
+      atomic_ullong dropped_lines;
+      atomic_ullong gaps;
+      atomic_ullong slow_disconnects;
+      atomic_ullong blocks; /* a reader started holding writers back */
+      atomic_ullong holds;  /* a writer went over its rate (-O pause) */
+      atomic_ullong rate_dropped;
+      atomic_ullong verbose_held;
+} Stats;
+
+#define COUNT( field, n )                                                      \
+      atomic_fetch_add_explicit( &stats.field, ( n ), memory_order_relaxed )
+#define CHAN_COUNT( ch, field, n )                                             \
+      atomic_fetch_add_explicit( &( ch )->field, ( n ), memory_order_relaxed )
+
+/* Event loop iterations by how long their work took (not the wait):
+ * le[ i ] counts those of up to 2^i µs, the last bucket any longer. */
+typedef struct
+{
+      atomic_ullong le[ HIST_BUCKETS ];
+      atomic_ullong sum_us;
+} Hist;
+
+/* A reader thread (-t): its own epoll loop over the readers handed to it */
+typedef struct Worker
+{
+      pthread_t tid;
+      int id;
+      int ep_fd;
+      int wake_fd; /* eventfd: new data, new readers, dump or quit */
+      Client **readers;
+      size_t num_readers;
+      size_t readers_cap;
+      Client **dead;
+      size_t num_dead;
+      size_t dead_cap;
+      atomic_size_t load; /* its readers, as the main loop sees them */
+      atomic_bool dump;
+      atomic_bool quit;
+      Hist loop_hist;
+
+      /* readers passed on by the main loop: it fills the slots at
+       * in_tail, the worker takes them from in_head */
+      Client *inbox[ INBOX_SIZE ];
+      atomic_size_t in_head;
+      atomic_size_t in_tail;
+} Worker;
+
+/* Clients live on the heap and are reached through epoll's data.ptr, so
+ * a wakeup costs O(ready) no matter how many are connected. Readers (for
+ * broadcast) and writers (to pause them) are also kept in dense arrays
+ * that double when full. A client dropped while its events may still be
+ * pending in the current batch is parked on `dead` and freed afterwards.
+ * With -t, readers on the ring are handed to worker threads, which keep
+ * the same lists (and epoll set) of their own. */
+static Client **readers           = NULL;
+static size_t readers_cap         = 0;
+static Client **writers           = NULL;
+static size_t writers_cap         = 0;
+static Client **pending           = NULL; /* handshake not seen yet */
+static size_t pending_cap         = 0;
+static size_t num_pending         = 0;
+static uint64_t pending_due       = 0; /* now_ms() the oldest times out */
+static Client **dead              = NULL;
+static size_t num_dead            = 0;
+static size_t dead_cap            = 0;
+static int ep_fd                  = -1;
+static int srv_fd                 = -1;
+static bool verbose               = false;
+static size_t num_readers         = 0;
+static size_t num_writers         = 0;
+static size_t max_clients         = DEF_MAX_CLIENTS;
+static long hello_ms              = DEF_HELLO_MS;
+static int listen_backlog         = DEF_LISTEN_BACKLOG;
+static size_t queue_limit         = DEF_QUEUE_LIMIT;
+static size_t line_limit          = DEF_LINE_LIMIT;
+static Overflow overflow          = OVF_DROP;
+static long coalesce_ms           = DEF_COALESCE_MS;
+static const char *sock_path      = DEF_SOCK;
+static const char *pkt_path       = NULL; /* -S, off by default */
+static int pkt_fd                 = -1;
+static size_t writer_rate         = 0; /* -r bytes/s, 0: unlimited */
+static size_t writer_burst        = 0; /* -k, 0: a second's worth */
+static bool rate_drop             = false; /* -O drop */
+static size_t num_held            = 0;
+static uint64_t held_due          = UINT64_MAX; /* now_ms() one is let go */
+static volatile sig_atomic_t stop = 0;
+static volatile sig_atomic_t dump = 0;
+static volatile sig_atomic_t restart = 0;
+static unsigned verbose_rate      = DEF_VERBOSE_RATE; /* 0: unlimited */
+static const char *ctl_path       = NULL; /* -C, off by default */
+static int ctl_fd                 = -1;
+static Stats stats;
+static Hist loop_hist;       /* the main loop's */
+static uint64_t started_ms   = 0;
+static char **self_argv;     /* what a restart execs */
+static bool keep_socket_files = false; /* another process serves them */
+static bool taking_over       = false; /* filling the rings handed over */
+
+/* channels: the default one first, named ones as they are asked for
+ * (and kept until the daemon exits) */
+static Channel main_ch                   = { .next_seq = 1 };
+static Channel *channels[ MAX_CHANNELS ] = { &main_ch };
+static size_t num_channels               = 1;
+
+/* bumped by every fanout: workers send to their readers when it moves */
+static atomic_ullong fanout_gen = 0;
+
+/* shared memory ring (-M), off when shm_size is 0 */
+static size_t shm_size       = 0;
+static int shm_fd            = -1;
+static ShmHeader *shm_hdr    = NULL;
+static char *shm_data        = NULL;
+static uint64_t shm_used[ SHM_SLOTS / 64 ];
+
+/* relay mode (-Z): writer bytes go through relay_pipe, never buf */
+static bool relay          = false;
+static int relay_pipe[ 2 ] = { -1, -1 };
+static size_t relay_cap    = 0; /* bytes relay_pipe holds */
+static size_t relay_pend   = 0; /* bytes in it not teed to readers yet */
+static int null_fd         = -1;
+
+/* reader threads (-t), none by default: then the main loop does it all */
+static Worker *workers  = NULL;
+static int num_workers  = 0;
+static int main_wake_fd = -1; /* eventfd: a worker's reader (un)blocked */
+
+/* fanout is deferred: input gathered in one loop iteration (and, within
+ * coalesce_ms, in the following ones) reaches each reader in one writev */
+static bool fanout_due            = false;
+static uint64_t fanout_at         = 0; /* now_ms() it is due by */
+static unsigned long long fanouts = 0;
+
+/* replay backlog kept in the ring for READER since=-<n> */
+static size_t backlog_lines = DEF_BACKLOG_LINES;
+static size_t backlog_bytes = DEF_BACKLOG_BYTES;
+
+/* durable log (-d), off when log_dir is NULL */
+static const char *log_dir      = NULL;
+static bool stamp_time          = false; /* -T */
+static bool numbered            = false; /* -d or -T: lines are records */
+static size_t log_seg_bytes     = DEF_LOG_SEG_BYTES;
+static long long log_max_bytes  = DEF_LOG_MAX_BYTES; /* 0: unlimited */
+static long log_max_age         = 0;                 /* s, 0: unlimited */
+static long log_fsync_ms        = DEF_LOG_FSYNC_MS;
 
 /* ───────────────────────── helpers ───────────────────────── */
 
 #define V( fmt, ... )                                                          \
       do                                                                       \
       {                                                                        \
-            if ( verbose )                                                     \
+            if ( verbose && verbose_ok() )                                     \
                   fprintf( stderr, fmt, ##__VA_ARGS__ );                       \
       } while ( 0 )
 
+static uint64_t now_ms( void );
+
+/* -v is rate limited, so it can be left on under load: up to
+ * verbose_rate messages a second go out, the rest are counted and
+ * reported in one line when the next second starts. */
+static bool verbose_ok( void )
+{
+      static _Atomic uint64_t sec;
+      static atomic_uint sent;
+      static atomic_ullong held;
+      if ( !verbose_rate )
+            return true;
+
+      uint64_t now = now_ms() / 1000;
+      uint64_t was = atomic_load_explicit( &sec, memory_order_relaxed );
+      if ( now != was && atomic_compare_exchange_strong( &sec, &was, now ) )
+      {
+            atomic_store( &sent, 0 );
+            unsigned long long n = atomic_exchange( &held, 0 );
+            if ( n )
+                  fprintf( stderr, "srv: %llu verbose messages held back\n", n );
+      }
+      if ( atomic_fetch_add_explicit( &sent, 1, memory_order_relaxed ) <
+           verbose_rate )
+            return true;
+      atomic_fetch_add_explicit( &held, 1, memory_order_relaxed );
+      COUNT( verbose_held, 1 );
+      return false;
+}
+
+/* Readers of the main loop and of every worker. */
+static size_t total_readers( void )
+{
+      size_t n = num_readers;
+      for ( int i = 0; i < num_workers; ++i )
+            n += atomic_load_explicit( &workers[ i ].load,
+                                       memory_order_relaxed );
+      return n;
+}
+
 static void bump_counts( int delta_reader, int delta_writer )
 {
       num_readers += delta_reader;
       num_writers += delta_writer;
-      V( "   ↻ readers=%zu writers=%zu\n", num_readers, num_writers );
+      V( "   ↻ readers=%zu writers=%zu\n", total_readers(), num_writers );
+}
+
+static void wake( int fd )
+{
+      uint64_t one = 1;
+      write( fd, &one, sizeof one );
+}
+
+/* End of ch's ring as far as readers go. */
+static uint64_t ring_published( Channel *ch )
+{
+      return atomic_load_explicit( &ch->ring_pub, memory_order_acquire );
 }
 
 static void cleanup( void )
 {
+      if ( keep_socket_files )
+            return;
       if ( srv_fd != -1 )
             close( srv_fd );
-      unlink( DEF_SOCK );
+      srv_fd = -1;
+      unlink( sock_path );
+      if ( pkt_fd != -1 )
+      {
+            close( pkt_fd );
+            unlink( pkt_path );
+      }
+      pkt_fd = -1;
+      if ( ctl_fd != -1 )
+      {
+            close( ctl_fd );
+            unlink( ctl_path );
+      }
+      ctl_fd = -1;
 }
 
 static void die( const char *msg )
@@ -60,203 +498,3800 @@ static void die( const char *msg )
       _exit( 1 );
 }
 
+/* SIGINT/SIGTERM only interrupt epoll_wait; main returns and atexit
+ * removes the socket. SIGUSR1 asks for a counter dump, SIGUSR2 for a
+ * restart. */
+static void on_signal( int sig )
+{
+      if ( sig == SIGUSR1 )
+            dump = 1;
+      else if ( sig == SIGUSR2 )
+            restart = 1;
+      else
+            stop = 1;
+}
+
+/* Grows *arr (of `elem`-sized items, capacity *cap) to hold `need`. */
+static void *grow( void *arr, size_t *cap, size_t need, size_t elem )
+{
+      if ( need <= *cap )
+            return arr;
+      size_t n = *cap ? *cap : 64;
+      while ( n < need )
+            n *= 2;
+      void *p = realloc( arr, n * elem );
+      if ( !p )
+            die( "realloc" );
+      *cap = n;
+      return p;
+}
+
+static uint64_t now_ms( void )
+{
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_us( void )
+{
+      struct timespec ts;
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void hist_add( Hist *h, uint64_t us )
+{
+      int i = 0;
+      while ( i < HIST_BUCKETS - 1 && us > 1ull << i )
+            ++i;
+      atomic_fetch_add_explicit( &h->le[ i ], 1, memory_order_relaxed );
+      atomic_fetch_add_explicit( &h->sum_us, us, memory_order_relaxed );
+}
+
+/* Newlines in p[ 0..len ). */
+static size_t count_lines( const char *p, size_t len )
+{
+      size_t n = 0;
+      for ( const char *end = p + len; ( p = memchr( p, '\n', end - p ) ); ++p )
+            ++n;
+      return n;
+}
+
+/* epoll_wait timeout: the sooner of `timeout` (-1 for none) and `due`. */
+static int wait_until( int timeout, uint64_t due, uint64_t now )
+{
+      int t = due > now ? (int)( due - now ) : 0;
+      return timeout == -1 || t < timeout ? t : timeout;
+}
+
+/* Every client is an fd; make sure the fd limit is not what caps us. */
+static void raise_fd_limit( void )
+{
+      struct rlimit rl;
+      if ( getrlimit( RLIMIT_NOFILE, &rl ) == -1 )
+            return;
+      rlim_t want = (rlim_t)max_clients + 16;
+      if ( rl.rlim_cur >= want )
+            return;
+      rl.rlim_cur = rl.rlim_max < want ? rl.rlim_max : want;
+      if ( setrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < want )
+            V( "srv: fd limit %llu, fewer than %zu clients fit\n",
+               (unsigned long long)rl.rlim_cur, max_clients );
+}
+
 /* ─────────────────────── client table ────────────────────── */
 
-static int add_client( int fd, bool is_reader )
+static void set_events( Client *c, uint32_t events )
 {
-      for ( int i = 0; i < MAX_CLIENTS; ++i )
-            if ( !clients[ i ].active )
-            {
-                  clients[ i ] = (Client){
-                      .fd = fd, .is_reader = is_reader, .active = true };
-                  bump_counts( is_reader, !is_reader );
-                  V( "cli#%d ⇒ registered as %s\n", fd,
-                     is_reader ? "READER" : "WRITER" );
-                  return i;
-            }
-      return -1;
+      struct epoll_event ev = { .events = events, .data.ptr = c };
+      epoll_ctl( c->w ? c->w->ep_fd : ep_fd, EPOLL_CTL_MOD, c->fd, &ev );
+}
+
+static void reader_attach( Client *c );
+static void reader_detach( Client *c );
+static void ring_trim( Channel *ch );
+static void sync_writers( void );
+static void relay_flush( void );
+static bool relay_send( Client *c );
+static void ctl_flush( Client *c );
+static void fanout_soon( Channel *ch );
+static void bucket_set( Client *c, size_t rate );
+static void writer_note( Client *c, bool last );
+static bool channel_join( Client *c, const char *name );
+
+/* Puts c after the `count` entries of `*list` (`*cap` room); the caller
+ * counts it in. */
+static void list_add( Client *c, Client ***list, size_t count, size_t *cap )
+{
+      *list              = grow( *list, cap, count + 1, sizeof **list );
+      ( *list )[ count ] = c;
+      c->slot            = (int)count;
+}
+
+/* Takes c out of the list it is in, swapping the last entry into its
+ * slot; the caller counts it out. */
+static void list_remove( Client *c )
+{
+      Client **list = c->w ? c->w->readers
+                      : c->hello     ? pending
+                      : c->is_reader ? readers
+                                     : writers;
+      size_t *count = c->w ? &c->w->num_readers
+                      : c->hello     ? &num_pending
+                      : c->is_reader ? &num_readers
+                                     : &num_writers;
+      list[ c->slot ]       = list[ *count - 1 ];
+      list[ c->slot ]->slot = c->slot;
+      list[ *count - 1 ]    = NULL;
+}
+
+/* A connection just accepted, pending until its handshake is in. */
+static Client *add_client( int fd )
+{
+      if ( total_readers() + num_writers + num_pending >= max_clients )
+            return NULL;
+
+      Client *c = calloc( 1, sizeof *c );
+      if ( !c || !( c->hello = malloc( HELLO_MAX ) ) )
+      {
+            free( c );
+            return NULL;
+      }
+      c->fd          = fd;
+      c->ch          = &main_ch;
+      c->disk_fd     = -1;
+      c->pipe_fd[ 0 ] = -1;
+      c->pipe_fd[ 1 ] = -1;
+      c->hello_by = hello_ms ? now_ms() + (uint64_t)hello_ms : UINT64_MAX;
+
+      struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+      if ( epoll_ctl( ep_fd, EPOLL_CTL_ADD, fd, &ev ) == -1 )
+      {
+            free( c->hello );
+            free( c );
+            return NULL;
+      }
+      if ( !num_pending )
+            pending_due = c->hello_by;
+      list_add( c, &pending, num_pending++, &pending_cap );
+      return c;
+}
+
+/* Moves pending c on to the readers or the writers. */
+static void set_role( Client *c, bool is_reader )
+{
+      list_remove( c );
+      --num_pending;
+      free( c->hello );
+      c->hello     = NULL;
+      c->is_reader = is_reader;
+      if ( is_reader )
+      {
+            list_add( c, &readers, num_readers, &readers_cap );
+            reader_attach( c );
+      }
+      else
+      {
+            list_add( c, &writers, num_writers, &writers_cap );
+            if ( writer_rate )
+                  bucket_set( c, writer_rate );
+            if ( c->ch->paused )
+                  set_events( c, 0 ); /* starts paused, like the others */
+      }
+      if ( is_reader )
+            atomic_fetch_add( &c->ch->readers, 1 );
+      else
+            ++c->ch->writers;
+      bump_counts( is_reader, !is_reader );
+      V( "cli#%d ⇒ registered as %s%s%s\n", c->fd,
+         is_reader ? "READER" : "WRITER", *c->ch->name ? " on " : "",
+         c->ch->name );
+}
+
+/* Counts c in or out of the readers holding its channel's writers back
+ * (OVF_BLOCK). The main loop pauses or resumes them; a worker wakes it up
+ * to. */
+static void reader_block( Client *c, bool on )
+{
+      c->blocking = on;
+      if ( on )
+            COUNT( blocks, 1 );
+      size_t was  = on ? atomic_fetch_add( &c->ch->blocking, 1 )
+                       : atomic_fetch_sub( &c->ch->blocking, 1 );
+      if ( was != ( on ? 0 : 1 ) )
+            return;
+      if ( c->w )
+            wake( main_wake_fd );
+      else
+            sync_writers();
 }
 
-static void drop_client( int idx )
+static void drop_client( Client *c )
 {
-      if ( !clients[ idx ].active )
+      if ( c->fd == -1 )
+            return;
+      if ( c->ctl )
+      {
+            close( c->fd );
+            c->fd = -1;
+            free( c->pend );
+            dead  = grow( dead, &dead_cap, num_dead + 1, sizeof *dead );
+            dead[ num_dead++ ] = c;
             return;
-      V( "cli#%d ⌁ hang-up\n", clients[ idx ].fd );
+      }
+      if ( c->is_reader )
+            V( "cli#%d ⌁ hang-up (sent %llu B, dropped %llu lines in %llu "
+               "gaps, max lag %zu B)\n",
+               c->fd, c->sent, c->dropped_lines, c->gaps, c->max_lag );
+      else
+            V( "cli#%d ⌁ hang-up%s\n", c->fd,
+               c->hello ? " before its handshake" : "" );
+      if ( c->held )
+      {
+            c->held = false;
+            --num_held;
+            c->held_ms += now_ms() - c->held_at;
+            c->unnoted_ms += now_ms() - c->held_at;
+      }
+      writer_note( c, true );
+
+      Worker *w = c->w;
+      if ( !c->hello && c->is_reader )
+            atomic_fetch_sub( &c->ch->readers, 1 );
+      else if ( !c->hello )
+            --c->ch->writers;
+      list_remove( c );
+      if ( w )
+      {
+            --w->num_readers;
+            atomic_fetch_sub( &w->load, 1 );
+            V( "   ↻ worker %d readers=%zu\n", w->id, w->num_readers );
+      }
+      else if ( c->hello )
+            --num_pending;
+      else
+            bump_counts( c->is_reader ? -1 : 0, c->is_reader ? 0 : -1 );
+
+      close( c->fd ); /* also removes it from the epoll set */
+      c->fd = -1;
+      if ( c->disk_fd != -1 )
+            close( c->disk_fd );
+      if ( c->pipe_fd[ 0 ] != -1 )
+      {
+            close( c->pipe_fd[ 0 ] );
+            close( c->pipe_fd[ 1 ] );
+      }
+      if ( c->is_reader )
+            reader_detach( c );
 
-      bump_counts( clients[ idx ].is_reader ? -1 : 0,
-                   clients[ idx ].is_reader ? 0 : -1 );
+      if ( c->blocking )
+            reader_block( c, false );
 
-      close( clients[ idx ].fd );
-      clients[ idx ] = (Client){ 0 };
+      Client ***list = w ? &w->dead : &dead;
+      size_t *count  = w ? &w->num_dead : &num_dead;
+      *list = grow( *list, w ? &w->dead_cap : &dead_cap, *count + 1,
+                    sizeof **list );
+      ( *list )[ ( *count )++ ] = c;
 }
 
-static void broadcast( const char *buf, size_t len )
+static void free_clients( Client **list, size_t n )
 {
-      size_t fanout = 0;
-      for ( int i = 0; i < MAX_CLIENTS; ++i )
+      for ( size_t i = 0; i < n; ++i )
       {
-            if ( clients[ i ].active && clients[ i ].is_reader )
-            {
-                  ssize_t n = write( clients[ i ].fd, buf, len );
-                  if ( n == -1 )
-                  {
-                        if ( errno == EAGAIN || errno == EWOULDBLOCK )
-                        {
-                              V( "cli#%d skipped (EAGAIN)\n", clients[ i ].fd );
-                              continue; // skip, but don't drop
-                        }
-                        else
-                        {
-                              drop_client( i ); // real error
-                        }
-                  }
-                  else if ( n < (ssize_t)len )
-                  {
-                        V( "cli#%d partial write (%zd/%zu), dropping\n",
-                           clients[ i ].fd, n, len );
-                        drop_client(
-                            i ); // optional: implement buffering instead
-                  }
-                  else
-                  {
-                        ++fanout;
-                  }
-            }
+            free( list[ i ]->hello );
+            free( list[ i ]->part );
+            free( list[ i ]->subs );
+            free( list[ i ]->wants );
+            free( list[ i ] );
       }
+}
 
-      V( "    → delivered %zu bytes to %zu reader(s)\n", len, fanout );
+static void reap_clients( void )
+{
+      free_clients( dead, num_dead );
+      num_dead = 0;
+      for ( size_t i = 0; i < num_channels; ++i )
+            ring_trim( channels[ i ] );
 }
-// Old one returning EAGAIN socket error on pressure: static void broadcast(
-// const char *buf, size_t len )
-//{
-//      size_t fanout = 0;
-//      for ( int i = 0; i < MAX_CLIENTS; ++i )
-//            if ( clients[ i ].active && clients[ i ].is_reader )
-//            {
-//                  if ( write( clients[ i ].fd, buf, len ) != (ssize_t)len )
-//                        drop_client( i ); /* broken pipe */
-//                  else
-//                        ++fanout;
-//            }
-//
-//      V( "    → delivered %zu bytes to %zu reader(s)\n", len, fanout );
-//}
 
-/* ─────────────────────────── main ────────────────────────── */
+/* ─────────────────────── subscriptions ───────────────────── */
 
-int main( int argc, char **argv )
+/* A reader may subscribe to some @types only (READER types=lsp,build*).
+ * Every line's type is looked up once, when it enters the ring, and kept
+ * with its offset in the line index; each subscribed reader holds a bitmap
+ * over type ids, filled in once per type as types first appear, so routing
+ * a line to it is a single bit test. */
+
+static char type_names[ MAX_TYPES ][ MAX_TYPE ];
+static size_t num_types                 = 0;
+static uint16_t type_slots[ TYPE_SLOTS ] = { 0 }; /* id + 1, 0 if free */
+
+/* Whether `name` is in the comma separated list `subs`, where an entry
+ * ending in '*' matches every type starting with the rest of it. */
+static bool subs_match( const char *subs, const char *name )
 {
-      const char *sock_path = DEF_SOCK;
-      for ( int i = 1; i < argc; ++i )
-            if ( !strcmp( argv[ i ], "-v" ) ||
-                 !strcmp( argv[ i ], "--verbose" ) )
-                  verbose = true;
-            else if ( !strcmp( argv[ i ], "-p" ) && i + 1 < argc )
-                  sock_path = argv[ ++i ];
-            else
-            {
-                  fprintf( stderr, "usage: %s [-v] [-p <sock>]\n", argv[ 0 ] );
-                  return 1;
-            }
+      size_t len = strlen( name );
+      for ( const char *p = subs; *p; )
+      {
+            size_t n    = strcspn( p, "," );
+            bool prefix = n && p[ n - 1 ] == '*';
+            size_t m    = prefix ? n - 1 : n;
+            if ( ( prefix ? len >= m : len == m ) && !memcmp( p, name, m ) )
+                  return true;
+            p += n + ( p[ n ] == ',' );
+      }
+      return false;
+}
 
-      signal( SIGINT, (void ( * )( int ))cleanup );
-      signal( SIGTERM, (void ( * )( int ))cleanup );
-      atexit( cleanup );
+static void want_type( Client *c, size_t id )
+{
+      if ( id == TYPE_OTHER || subs_match( c->subs, type_names[ id ] ) )
+            c->wants[ id / 64 ] |= 1ull << ( id % 64 );
+}
 
-      unlink( sock_path );
-      srv_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
-      if ( srv_fd == -1 )
-            die( "socket" );
+static bool wanted( const Client *c, uint32_t id )
+{
+      return !c->wants || ( c->wants[ id / 64 ] >> ( id % 64 ) & 1 );
+}
 
-      struct sockaddr_un sa = { .sun_family = AF_UNIX };
-      strncpy( sa.sun_path, sock_path, sizeof( sa.sun_path ) - 1 );
-      if ( bind( srv_fd, (struct sockaddr *)&sa, sizeof( sa ) ) )
-            die( "bind" );
-      if ( listen( srv_fd, 16 ) )
-            die( "listen" );
+/* Id of type `name` (`len` bytes), added on first sight. Once the table is
+ * full, new types share TYPE_OTHER, which every subscriber is sent. */
+static uint32_t type_id( const char *name, size_t len )
+{
+      uint32_t h = 2166136261u; /* FNV-1a */
+      for ( size_t i = 0; i < len; ++i )
+            h = ( h ^ (unsigned char)name[ i ] ) * 16777619u;
+
+      for ( size_t i = h % TYPE_SLOTS;; i = ( i + 1 ) % TYPE_SLOTS )
+      {
+            uint16_t id = type_slots[ i ];
+            if ( id && !strncmp( type_names[ id - 1 ], name, len ) &&
+                 !type_names[ id - 1 ][ len ] )
+                  return id - 1u;
+            if ( id )
+                  continue;
 
-      V( "srv: listening on %s\n", sock_path );
+            if ( num_types == TYPE_OTHER )
+                  return TYPE_OTHER;
+            memcpy( type_names[ num_types ], name, len );
+            type_slots[ i ] = (uint16_t)++num_types;
+            for ( size_t r = 0; r < num_readers; ++r )
+                  if ( readers[ r ]->wants )
+                        want_type( readers[ r ], num_types - 1 );
+            V( "srv: new type @%s\n", type_names[ num_types - 1 ] );
+            return (uint32_t)num_types - 1;
+      }
+}
 
-      char buf[ BUF_SIZE ];
-      for ( ;; )
+/* Type of a line as nntm sees it: the first "@word" in it, "all" for
+ * lines with none (or with an empty or over-long one). */
+static uint32_t line_type( const char *p, size_t len )
+{
+      const char *at = memchr( p, '@', len );
+      if ( !at )
+            return TYPE_ALL;
+      const char *end = at + 1;
+      while ( end < p + len && *end != ' ' && ( *end < '\t' || *end > '\r' ) )
+            ++end;
+      size_t n = (size_t)( end - at ) - 1;
+      return n && n < MAX_TYPE ? type_id( at + 1, n ) : TYPE_ALL;
+}
+
+/* Restricts c to the types listed in `subs`. */
+static void reader_subscribe( Client *c, const char *subs )
+{
+      c->subs  = strdup( subs );
+      c->wants = calloc( MAX_TYPES / 64, sizeof *c->wants );
+      if ( !c->subs || !c->wants )
+            die( "malloc" );
+      for ( size_t id = 0; id < num_types; ++id )
+            want_type( c, id );
+      want_type( c, TYPE_OTHER );
+      V( "cli#%d ⇒ subscribed to %s\n", c->fd, subs );
+}
+
+/* ─────────────────── shared memory ring (-M) ─────────────── */
+
+/* With -M the stream is also copied into a ring in a memfd, which a local
+ * reader asking for "READER shm" is passed, with an eventfd of its own, to
+ * map and read by itself: delivery then costs no system call per reader
+ * and line, only an eventfd write at a fanout to a reader that went to
+ * sleep. Offsets in it are those of the broadcast ring. `reserved` moves
+ * past bytes before they are overwritten, so a reader can tell whether
+ * what it copied was intact, and `head` moves at each fanout, to a line
+ * boundary. The reader's socket stays open to tell when it is gone. */
+
+/* Maps a new shared ring, or the one a restart handed over in `fd`
+ * (-1: none), which must be of the same size. */
+static void shm_open_ring( int fd )
+{
+      size_t size = SHM_MIN;
+      while ( size < shm_size )
+            size *= 2;
+      shm_size        = size;
+      size_t data_off = ( sizeof( ShmHeader ) + 4095 ) & ~(size_t)4095;
+
+      struct stat st;
+      shm_fd = fd != -1 ? fd
+                        : memfd_create( "nntmd-shm",
+                                        MFD_CLOEXEC | MFD_ALLOW_SEALING );
+      if ( shm_fd == -1 )
+            die( "memfd_create" );
+      if ( fd != -1 && ( fstat( fd, &st ) == -1 ||
+                         st.st_size != (off_t)( data_off + size ) ) )
       {
-            struct pollfd p[ MAX_CLIENTS + 1 ];
-            int nf = 0;
+            fprintf( stderr, "nntmd: the shared ring handed over is not "
+                             "%zu B\n", size );
+            exit( 1 );
+      }
+      if ( fd == -1 &&
+           ftruncate( shm_fd, (off_t)( data_off + size ) ) == -1 )
+            die( "ftruncate" );
+      /* readers may map it without fearing it shrinks under them */
+      if ( fd == -1 )
+            fcntl( shm_fd, F_ADD_SEALS,
+                   F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL );
+      void *p = mmap( NULL, data_off + size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, shm_fd, 0 );
+      if ( p == MAP_FAILED )
+            die( "mmap" );
+      shm_hdr  = p;
+      shm_data = (char *)p + data_off;
+      if ( fd != -1 )
+            return; /* head and the readers' slots as they were */
+      shm_hdr->magic    = SHM_MAGIC;
+      shm_hdr->size     = size;
+      shm_hdr->data_off = data_off;
+}
+
+/* Copies buf to the shared ring at the default channel's ring_end. */
+static void shm_append( const char *buf, size_t len )
+{
+      uint64_t off = main_ch.ring_end;
+      atomic_store_explicit( &shm_hdr->reserved, off + len,
+                             memory_order_relaxed );
+      atomic_thread_fence( memory_order_release );
 
-            p[ nf++ ] = (struct pollfd){ srv_fd, POLLIN };
+      if ( len > shm_size )
+      {
+            off += len - shm_size; /* only the end of it fits */
+            buf += len - shm_size;
+            len = shm_size;
+      }
+      size_t at = off & ( shm_size - 1 );
+      size_t n  = shm_size - at < len ? shm_size - at : len;
+      memcpy( shm_data + at, buf, n );
+      memcpy( shm_data, buf + n, len - n );
+}
 
-            for ( int i = 0; i < MAX_CLIENTS; ++i )
-                  if ( clients[ i ].active )
-                        p[ nf++ ] = (struct pollfd){ clients[ i ].fd, POLLIN };
+/* Fanout to the shared ring: moves head on and wakes the readers that
+ * are asleep (each sets `sleeping` before it looks at head a last time). */
+static void shm_publish( void )
+{
+      if ( main_ch.ring_mid )
+            return; /* whole lines only */
+      atomic_store( &shm_hdr->head, main_ch.ring_end );
+      for ( size_t i = 0; i < num_readers; ++i )
+      {
+            Client *c = readers[ i ];
+            if ( c->shm &&
+                 atomic_exchange( &shm_hdr->slots[ c->shm_slot ].sleeping, 0 ) )
+                  wake( c->shm_efd );
+      }
+}
 
-            if ( poll( p, nf, -1 ) < 0 )
+/* A free reader slot, marked taken, or -1. */
+static int shm_slot_take( void )
+{
+      for ( int i = 0; i < SHM_SLOTS; ++i )
+            if ( !( shm_used[ i / 64 ] >> ( i % 64 ) & 1 ) )
             {
-                  if ( errno == EINTR )
-                        continue;
-                  die( "poll" );
+                  shm_used[ i / 64 ] |= 1ull << ( i % 64 );
+                  return i;
             }
+      return -1;
+}
 
-            /* ─── new connection ─── */
-            if ( p[ 0 ].revents & POLLIN )
-            {
-                  int cfd = accept( srv_fd, NULL, NULL );
-                  if ( cfd == -1 )
-                  {
-                        perror( "accept" );
-                        continue;
-                  }
+static void shm_release( Client *c )
+{
+      shm_used[ c->shm_slot / 64 ] &= ~( 1ull << ( c->shm_slot % 64 ) );
+      close( c->shm_efd );
+      c->shm = false;
+}
 
-                  /* peek first 8 bytes to check for handshake */
-                  char hdr[ 8 ] = { 0 };
-                  ssize_t n     = recv( cfd, hdr, sizeof( hdr ) - 1, MSG_PEEK );
+/* ─────────────────────── broadcast ring ──────────────────── */
 
-                  bool is_reader = false;
-                  if ( n >= 7 && !memcmp( hdr, "READER\n", 7 ) )
-                  {
-                        /* consume handshake line */
-                        read( cfd, hdr, 7 );
-                        write( cfd, "OK\n", 3 );
-                        is_reader = true;
-                  }
-                  else if ( n >= 7 && !memcmp( hdr, "WRITER\n", 7 ) )
-                  {
-                        read( cfd, hdr, 7 ); /* eat it */
-                        write( cfd, "OK\n", 3 );
-                        is_reader = false;
-                  }
+/* Writer data is copied once, into a chain of fixed-size segments. Each
+ * reader only holds a cursor (a stream offset) into it and is sent
+ * straight from the segments with writev, so memory is bounded by the
+ * slowest reader's lag, not by the number of readers. A segment counts
+ * the readers whose cursor lies in it and is freed once it is the oldest
+ * and none is left. The line index next to it finds line starts (for
+ * replays and subscribed readers) by binary search. Every channel has a
+ * ring and an index of its own.
+ *
+ * Only the main loop adds to the ring (and frees from it). Worker threads
+ * read it up to ring_pub, which is stored after the bytes before it, so
+ * they never look at a segment's len or at bytes still being written: a
+ * segment is only followed by another once it is full. */
 
-                  if ( add_client( cfd, is_reader ) == -1 )
-                  {
-                        V( "srv: max clients reached\n" );
-                        close( cfd );
-                  }
-                  /* if it’s NOT a reader, leave the socket in the table as
-                     writer; any data waiting in the buffer will be picked up in
-                     next loop */
-                  continue;
-            }
+/* Offset past the last byte of s that a reader may send, `end` being
+ * ring_published(). */
+static uint64_t seg_end( const Segment *s, uint64_t end )
+{
+      return s->start + SEG_SIZE < end ? s->start + SEG_SIZE : end;
+}
 
-            /* ─── existing sockets ─── */
-            int idx = 1;
-            for ( int i = 0; i < MAX_CLIENTS; ++i )
-            {
-                  if ( !clients[ i ].active )
-                        continue;
+static LineRec *rec_at( Channel *ch, size_t i )
+{
+      return &ch->recs[ ( ch->recs_first + i ) & ( ch->recs_cap - 1 ) ];
+}
 
-                  if ( p[ idx ].revents & POLLIN )
-                  {
-                        ssize_t n = read( clients[ i ].fd, buf, sizeof( buf ) );
-                        if ( n <= 0 )
-                        { /* EOF / error */
-                              drop_client( i );
-                        }
-                        else if ( !clients[ i ].is_reader )
-                        { /* writer data */
-                              V( "cli#%d → %zd bytes\n", clients[ i ].fd, n );
-                              broadcast( buf, (size_t)n );
-                        }
-                  }
-                  ++idx;
-            }
+static void rec_push( Channel *ch, uint64_t off, uint32_t type )
+{
+      if ( ch->num_recs == ch->recs_cap )
+      {
+            size_t cap = ch->recs_cap ? ch->recs_cap * 2 : 1024;
+            LineRec *r = malloc( cap * sizeof *r );
+            if ( !r )
+                  die( "malloc" );
+            for ( size_t i = 0; i < ch->num_recs; ++i )
+                  r[ i ] = *rec_at( ch, i );
+            free( ch->recs );
+            ch->recs       = r;
+            ch->recs_cap   = cap;
+            ch->recs_first = 0;
+      }
+      *rec_at( ch, ch->num_recs++ ) = (LineRec){ off, type };
+}
+
+/* Index of the first line starting at or after `off` (num_recs if none). */
+static size_t rec_find( Channel *ch, uint64_t off )
+{
+      size_t lo = 0, hi = ch->num_recs;
+      while ( lo < hi )
+      {
+            size_t mid = lo + ( hi - lo ) / 2;
+            if ( rec_at( ch, mid )->off < off )
+                  lo = mid + 1;
+            else
+                  hi = mid;
       }
+      return lo;
+}
+
+static Segment *segment_new( Channel *ch )
+{
+      Segment *s = malloc( sizeof *s );
+      if ( !s )
+            die( "malloc" );
+      *s = (Segment){ .start = ch->ring_end };
+      if ( ch->ring_tail )
+            ch->ring_tail->next = s;
+      else
+            ch->ring_head = s;
+      ch->ring_tail = s;
+      return s;
+}
+
+static void ring_append( Channel *ch, const char *buf, size_t len )
+{
+      if ( !backlog_lines && !atomic_load( &ch->readers ) && !taking_over )
+            return; /* nobody to keep it for */
+      if ( shm_hdr && ch == &main_ch && !taking_over )
+            shm_append( buf, len );
+
+      /* index the lines that start in buf */
+      const char *end = buf + len;
+      for ( const char *q = buf; q < end; )
+      {
+            const char *nl  = memchr( q, '\n', (size_t)( end - q ) );
+            const char *eol = nl ? nl : end;
+            if ( !ch->ring_mid )
+                  rec_push( ch, ch->ring_end + (uint64_t)( q - buf ),
+                            line_type( q, (size_t)( eol - q ) ) );
+            ch->ring_mid = !nl;
+            q            = nl ? nl + 1 : end;
+      }
+
+      while ( len )
+      {
+            Segment *t = ch->ring_tail;
+            if ( !t || t->len == SEG_SIZE )
+                  t = segment_new( ch );
+            size_t n = SEG_SIZE - t->len;
+            if ( n > len )
+                  n = len;
+            memcpy( t->data + t->len, buf, n );
+            t->len += n;
+            ch->ring_end += n;
+            buf += n;
+            len -= n;
+      }
+      atomic_store_explicit( &ch->ring_pub, ch->ring_end,
+                             memory_order_release );
+}
+
+/* Frees the oldest segments once no reader is left in them and the
+ * newer ones hold the backlog on their own. */
+static void ring_trim( Channel *ch )
+{
+      Segment *s;
+      while ( ( s = ch->ring_head ) != ch->ring_tail && !s->refs &&
+              ( ch->num_recs - rec_find( ch, s->next->start ) >= backlog_lines ||
+                ch->ring_end - s->next->start >= backlog_bytes ) )
+      {
+            ch->ring_head = s->next;
+            free( s );
+      }
+      while ( ch->num_recs && rec_at( ch, 0 )->off < ch->ring_head->start )
+      {
+            ch->recs_first = ( ch->recs_first + 1 ) & ( ch->recs_cap - 1 );
+            --ch->num_recs;
+      }
+}
+
+/* Offset just past the first newline at or after `from`, or the end. */
+static uint64_t ring_line_end( Channel *ch, Segment *s, uint64_t from )
+{
+      uint64_t end = ring_published( ch );
+      for ( ; s && from < end; s = s->next )
+      {
+            uint64_t to = seg_end( s, end );
+            if ( from >= to )
+                  continue;
+            size_t off = from - s->start;
+            char *nl   = memchr( s->data + off, '\n', to - from );
+            if ( nl )
+                  return s->start + (uint64_t)( nl - s->data ) + 1;
+            from = to;
+      }
+      return end;
+}
+
+/* Stream offset where the newest `n` whole lines in ch's ring start,
+ * going back no further than the backlog and queue limits. */
+static uint64_t ring_backlog( Channel *ch, size_t n )
+{
+      if ( !ch->num_recs || !n || !backlog_lines )
+            return ch->ring_end;
+      if ( n > backlog_lines )
+            n = backlog_lines;
+
+      size_t num    = ch->num_recs;
+      uint64_t from = rec_at( ch, num > n ? num - n : 0 )->off;
+      size_t limit  = queue_limit < backlog_bytes ? queue_limit : backlog_bytes;
+      if ( ch->ring_end - from > limit )
+      {
+            size_t i = rec_find( ch, ch->ring_end - limit );
+            from     = i < num ? rec_at( ch, i )->off : ch->ring_end;
+      }
+      return from;
+}
+
+static size_t ring_segments( Channel *ch )
+{
+      size_t n = 0;
+      for ( Segment *s = ch->ring_head; s; s = s->next )
+            ++n;
+      return n;
+}
+
+/* Newlines in [from, to), copying the bytes to `dst` if given. */
+static unsigned long long ring_span( Segment *s, uint64_t from, uint64_t to,
+                                     char *dst )
+{
+      unsigned long long lines = 0;
+      for ( ; s && from < to; s = s->next )
+      {
+            uint64_t end = seg_end( s, to );
+            if ( from >= end )
+                  continue;
+            const char *p = s->data + ( from - s->start );
+            size_t n      = end - from;
+            if ( dst )
+            {
+                  memcpy( dst, p, n );
+                  dst += n;
+            }
+            for ( const char *q = p; ( q = memchr( q, '\n', p + n - q ) );
+                  ++q )
+                  ++lines;
+            from = end;
+      }
+      return lines;
+}
+
+/* Moves c's cursor to `pos`, passing its segment reference along (taking
+ * the next before letting go of the one it is in, or the main loop could
+ * free both in between). */
+static void reader_seek( Client *c, uint64_t pos )
+{
+      c->cursor = pos;
+      Segment *next;
+      while ( pos >= c->seg->start + SEG_SIZE && ( next = c->seg->next ) )
+      {
+            ++next->refs;
+            --c->seg->refs;
+            c->seg = next;
+      }
+}
+
+static void reader_attach( Client *c )
+{
+      Channel *ch = c->ch;
+      if ( !ch->ring_tail )
+            segment_new( ch );
+      c->seg    = ch->ring_tail;
+      c->cursor = ch->ring_end; /* live data only */
+      ++c->seg->refs;
+}
+
+/* Rewinds a fresh reader to `from` (for a replay) and sends what is there
+ * in one go, before any live data. */
+static void reader_rewind( Client *c, uint64_t from )
+{
+      Segment *s = c->ch->ring_head;
+      while ( from >= s->start + s->len && s->next )
+            s = s->next;
+      --c->seg->refs;
+      c->seg    = s;
+      c->cursor = from;
+      ++c->seg->refs;
+      V( "cli#%d ⇐ replaying %llu B\n", c->fd,
+         (unsigned long long)( c->ch->ring_end - from ) );
+}
+
+static void reader_detach( Client *c )
+{
+      if ( c->seg )
+            --c->seg->refs;
+      c->seg = NULL;
+      free( c->pend );
+      if ( c->shm )
+            shm_release( c );
+}
+
+/* ─────────────────────── durable log (-d) ────────────────── */
+
+/* With -d every line is numbered at ingest and travels as a record
+ * "<seq>\t<line>\n", in the ring and in the files alike, so a catching up
+ * reader is sent file bytes as they are (sendfile) and the ring and the
+ * files agree on where every sequence number is. With -T (which numbers
+ * the lines even without -d) the record also carries the CLOCK_REALTIME
+ * of its ingest: "<seq>:<ns>\t<line>\n".
+ *
+ * <dir>/<first seq>.log  records, a new file every log_seg_bytes
+ * <dir>/<first seq>.idx  (seq, offset) pairs every INDEX_STRIDE bytes
+ *
+ * Records are write()n as each batch is ingested, and one fdatasync per
+ * log_fsync_ms covers all of them (group commit). */
+
+typedef struct
+{
+      uint64_t first_seq;
+      off_t size;
+      time_t mtime;
+} LogFile;
+
+typedef struct
+{
+      uint64_t seq;
+      uint64_t off;
+} IndexEntry;
+
+static LogFile *log_files   = NULL; /* oldest first, last is being written */
+static size_t log_nfiles    = 0;
+static size_t log_files_cap = 0;
+static int log_fd           = -1;
+static int idx_fd           = -1;
+static off_t idx_last       = 0; /* log offset of the newest index entry */
+static bool log_dirty       = false;
+static uint64_t log_synced  = 0; /* ms */
+
+static void log_path( char *dst, size_t size, uint64_t first_seq,
+                      const char *ext )
+{
+      snprintf( dst, size, "%s/%020llu.%s", log_dir,
+                (unsigned long long)first_seq, ext );
+}
+
+static int fmt_u64( char *dst, uint64_t v )
+{
+      char tmp[ 20 ];
+      int n = 0;
+      do
+            tmp[ n++ ] = (char)( '0' + v % 10 );
+      while ( v /= 10 );
+      for ( int i = 0; i < n; ++i )
+            dst[ i ] = tmp[ n - 1 - i ];
+      return n;
+}
+
+/* Sequence number of the record starting at `p`, or 0 if it has none. */
+static uint64_t record_seq( const char *p, size_t len )
+{
+      uint64_t seq = 0;
+      size_t i     = 0;
+      for ( ; i < len && p[ i ] >= '0' && p[ i ] <= '9'; ++i )
+            seq = seq * 10 + (uint64_t)( p[ i ] - '0' );
+      size_t j = i;
+      if ( i && j < len && p[ j ] == ':' ) /* its time (-T) */
+            while ( ++j < len && p[ j ] >= '0' && p[ j ] <= '9' )
+                  ;
+      return i && j < len && p[ j ] == '\t' ? seq : 0;
+}
+
+static void log_sync( void )
+{
+      if ( log_dirty )
+      {
+            fdatasync( log_fd );
+            fdatasync( idx_fd );
+      }
+      log_dirty  = false;
+      log_synced = now_ms();
+}
+
+static void log_open( uint64_t first_seq )
+{
+      char path[ PATH_MAX ];
+      log_path( path, sizeof path, first_seq, "log" );
+      log_fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+      log_path( path, sizeof path, first_seq, "idx" );
+      idx_fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+      if ( log_fd == -1 || idx_fd == -1 )
+            die( path );
+      idx_last = -INDEX_STRIDE;
+
+      log_files = grow( log_files, &log_files_cap, log_nfiles + 1,
+                        sizeof *log_files );
+      log_files[ log_nfiles++ ] =
+          (LogFile){ .first_seq = first_seq, .mtime = time( NULL ) };
+}
+
+/* Deletes the oldest files while over the size or age limit; the file
+ * being written always stays. */
+static void log_retain( void )
+{
+      off_t total = 0;
+      for ( size_t i = 0; i < log_nfiles; ++i )
+            total += log_files[ i ].size;
+
+      time_t now = time( NULL );
+      while ( log_nfiles > 1 &&
+              ( ( log_max_bytes && total > (off_t)log_max_bytes ) ||
+                ( log_max_age && log_files[ 0 ].mtime + log_max_age < now ) ) )
+      {
+            char path[ PATH_MAX ];
+            log_path( path, sizeof path, log_files[ 0 ].first_seq, "log" );
+            unlink( path );
+            log_path( path, sizeof path, log_files[ 0 ].first_seq, "idx" );
+            unlink( path );
+            V( "log: expired %020llu\n",
+               (unsigned long long)log_files[ 0 ].first_seq );
+
+            total -= log_files[ 0 ].size;
+            memmove( log_files, log_files + 1,
+                     --log_nfiles * sizeof *log_files );
+      }
+}
+
+/* Appends a batch of whole records, the first numbered `first_seq`. */
+static void log_write( const char *buf, size_t len, uint64_t first_seq )
+{
+      LogFile *f = &log_files[ log_nfiles - 1 ];
+      if ( f->size && f->size + (off_t)len > (off_t)log_seg_bytes )
+      {
+            log_sync();
+            close( log_fd );
+            close( idx_fd );
+            log_open( first_seq );
+            log_retain();
+            f = &log_files[ log_nfiles - 1 ];
+      }
+
+      if ( f->size - idx_last >= INDEX_STRIDE )
+      {
+            IndexEntry e = { first_seq, (uint64_t)f->size };
+            if ( write( idx_fd, &e, sizeof e ) == (ssize_t)sizeof e )
+                  idx_last = f->size;
+      }
+
+      for ( size_t off = 0; off < len; )
+      {
+            ssize_t n = write( log_fd, buf + off, len - off );
+            if ( n == -1 && errno == EINTR )
+                  continue;
+            if ( n <= 0 )
+            {
+                  perror( "log write" );
+                  break;
+            }
+            off += (size_t)n;
+            f->size += n;
+      }
+      f->mtime  = time( NULL );
+      log_dirty = true;
+}
+
+static int cmp_log_file( const void *a, const void *b )
+{
+      uint64_t x = ( (const LogFile *)a )->first_seq;
+      uint64_t y = ( (const LogFile *)b )->first_seq;
+      return x < y ? -1 : x > y;
+}
+
+/* Takes ingested bytes (always ending in a newline by the time fanout
+ * runs) for ch's ring; with -d or -T they are numbered into records
+ * first and staged, so a whole batch goes to the ring and the log in one
+ * piece. The lines of one call share a timestamp. Named channels number
+ * their records only with -T, each from 1 and never to the log. */
+static void emit( Channel *ch, const char *p, size_t len )
+{
+      if ( ch == &main_ch ? !numbered : !stamp_time )
+      {
+            ring_append( ch, p, len );
+            return;
+      }
+
+      uint64_t ns = 0;
+      if ( stamp_time )
+      {
+            struct timespec ts;
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+      }
+      while ( len )
+      {
+            if ( !ch->stage_mid )
+            {
+                  if ( !ch->stage_len )
+                        ch->stage_seq = ch->next_seq;
+                  ch->stage = grow( ch->stage, &ch->stage_cap,
+                                    ch->stage_len + 42, 1 );
+                  ch->stage_len += (size_t)fmt_u64( ch->stage + ch->stage_len,
+                                                    ch->next_seq++ );
+                  if ( stamp_time )
+                  {
+                        ch->stage[ ch->stage_len++ ] = ':';
+                        ch->stage_len += (size_t)fmt_u64(
+                            ch->stage + ch->stage_len, ns );
+                  }
+                  ch->stage[ ch->stage_len++ ] = '\t';
+            }
+            const char *nl = memchr( p, '\n', len );
+            size_t n       = nl ? (size_t)( nl - p ) + 1 : len;
+            ch->stage = grow( ch->stage, &ch->stage_cap, ch->stage_len + n, 1 );
+            memcpy( ch->stage + ch->stage_len, p, n );
+            ch->stage_len += n;
+            ch->stage_mid = !nl;
+            p += n;
+            len -= n;
+      }
+}
+
+static void emit_flush( void )
+{
+      for ( size_t i = 0; i < num_channels; ++i )
+      {
+            Channel *ch = channels[ i ];
+            if ( !ch->stage_len )
+                  continue;
+            ring_append( ch, ch->stage, ch->stage_len );
+            if ( log_dir && ch == &main_ch )
+                  log_write( ch->stage, ch->stage_len, ch->stage_seq );
+            ch->stage_len = 0;
+      }
+}
+
+/* Picks up the files of an earlier run: the next sequence number follows
+ * the last record on disk, and a record torn by a crash is cut off. */
+static void log_recover( void )
+{
+      if ( mkdir( log_dir, 0755 ) == -1 && errno != EEXIST )
+            die( log_dir );
+
+      DIR *d = opendir( log_dir );
+      if ( !d )
+            die( log_dir );
+      struct dirent *de;
+      while ( ( de = readdir( d ) ) )
+      {
+            unsigned long long seq;
+            char ext[ 8 ];
+            if ( strlen( de->d_name ) != 24 ||
+                 sscanf( de->d_name, "%20llu.%3s", &seq, ext ) != 2 ||
+                 strcmp( ext, "log" ) )
+                  continue;
+
+            char path[ PATH_MAX ];
+            struct stat st;
+            log_path( path, sizeof path, seq, "log" );
+            if ( stat( path, &st ) == -1 )
+                  continue;
+            log_files = grow( log_files, &log_files_cap, log_nfiles + 1,
+                              sizeof *log_files );
+            log_files[ log_nfiles++ ] = (LogFile){
+                .first_seq = seq, .size = st.st_size, .mtime = st.st_mtime };
+      }
+      closedir( d );
+      qsort( log_files, log_nfiles, sizeof *log_files, cmp_log_file );
+
+      if ( !log_nfiles )
+      {
+            log_open( main_ch.next_seq );
+            return;
+      }
+
+      /* find the last newline, and the one before it */
+      LogFile *f = &log_files[ log_nfiles - 1 ];
+      char path[ PATH_MAX ];
+      log_path( path, sizeof path, f->first_seq, "log" );
+      int fd = open( path, O_RDWR | O_CLOEXEC );
+      if ( fd == -1 )
+            die( path );
+
+      char buf[ 4096 ];
+      off_t end = -1, start = 0;
+      for ( off_t pos = f->size; pos > 0 && start == 0; )
+      {
+            size_t n = pos < (off_t)sizeof buf ? (size_t)pos : sizeof buf;
+            pos -= (off_t)n;
+            if ( pread( fd, buf, n, pos ) != (ssize_t)n )
+                  break;
+            for ( size_t i = n; i-- > 0; )
+                  if ( buf[ i ] == '\n' )
+                  {
+                        if ( end == -1 )
+                              end = pos + (off_t)i;
+                        else
+                        {
+                              start = pos + (off_t)i + 1;
+                              break;
+                        }
+                  }
+      }
+
+      if ( end + 1 < f->size )
+      {
+            V( "log: cutting %lld torn bytes\n",
+               (long long)( f->size - end - 1 ) );
+            if ( ftruncate( fd, end + 1 ) == 0 )
+                  f->size = end + 1;
+      }
+      if ( end >= 0 )
+      {
+            char rec[ REC_HDR_MAX ];
+            ssize_t n = pread( fd, rec, sizeof rec, start );
+            uint64_t last = n > 0 ? record_seq( rec, (size_t)n ) : 0;
+            main_ch.next_seq = last ? last + 1 : f->first_seq;
+      }
+      else
+            main_ch.next_seq = f->first_seq;
+      close( fd );
+
+      /* continue the last file */
+      log_nfiles--;
+      off_t size = f->size;
+      log_open( f->first_seq );
+      log_files[ log_nfiles - 1 ].size = size;
+      V( "log: %zu file(s) in %s, next seq %llu\n", log_nfiles, log_dir,
+         (unsigned long long)main_ch.next_seq );
+}
+
+/* Offset of the first record numbered `seq` or later in file `i`, found
+ * through the sparse index and a short scan from there. */
+static off_t log_find( size_t i, uint64_t seq )
+{
+      char path[ PATH_MAX ];
+      off_t off = 0;
+
+      log_path( path, sizeof path, log_files[ i ].first_seq, "idx" );
+      int fd = open( path, O_RDONLY | O_CLOEXEC );
+      if ( fd != -1 )
+      {
+            IndexEntry e;
+            while ( read( fd, &e, sizeof e ) == (ssize_t)sizeof e &&
+                    e.seq <= seq && (off_t)e.off <= log_files[ i ].size )
+                  off = (off_t)e.off;
+            close( fd );
+      }
+
+      log_path( path, sizeof path, log_files[ i ].first_seq, "log" );
+      fd = open( path, O_RDONLY | O_CLOEXEC );
+      if ( fd == -1 )
+            return log_files[ i ].size;
+
+      /* records start right after a newline; read on from `off`, taking
+       * a record whose number is cut by the end of buf again next read */
+      char buf[ BUF_SIZE ];
+      bool at_start = true;
+      ssize_t n;
+      while ( ( n = pread( fd, buf, sizeof buf, off ) ) > 0 )
+      {
+            ssize_t k = 0;
+            for ( ; k < n; ++k )
+            {
+                  if ( at_start )
+                  {
+                        if ( n - k < REC_HDR_MAX && n == (ssize_t)sizeof buf &&
+                             k )
+                              break;
+                        if ( record_seq( buf + k, (size_t)( n - k ) ) >= seq )
+                        {
+                              close( fd );
+                              return off + k;
+                        }
+                  }
+                  at_start = buf[ k ] == '\n';
+            }
+            off += k;
+      }
+      close( fd );
+      return log_files[ i ].size;
+}
+
+/* ──────────────────────── reader output ──────────────────── */
+
+/* OVF_BLOCK: while any reader of a channel is over its limit, the
+ * channel's writers are left unread (their kernel buffers fill and their
+ * write()s block) rather than dropping anything. */
+static void sync_writers( void )
+{
+      bool changed = false;
+      for ( size_t i = 0; i < num_channels; ++i )
+      {
+            Channel *ch = channels[ i ];
+            bool pause  = atomic_load( &ch->blocking ) > 0;
+            if ( pause == ch->paused )
+                  continue;
+            ch->paused = pause;
+            changed    = true;
+            V( "srv: %s writers%s%s\n", pause ? "pausing" : "resuming",
+               *ch->name ? " of " : "", ch->name );
+      }
+      if ( !changed )
+            return;
+      for ( size_t i = 0; i < num_writers; ++i )
+      {
+            Client *c = writers[ i ];
+            set_events( c, c->ch->paused || c->held ? 0 : EPOLLIN );
+      }
+}
+
+static void pend_append( Client *c, const char *buf, size_t len )
+{
+      c->pend = grow( c->pend, &c->pend_cap, c->pend_len + len, 1 );
+      memcpy( c->pend + c->pend_len, buf, len );
+      c->pend_len += len;
+}
+
+/* OVF_DROP: skips c's cursor ahead to the first line boundary within
+ * half the limit of the newest data, so gaps are few and far between.
+ * The rest of a line already partly on the wire, then a marker line in
+ * place of what was skipped, are sent first. */
+static void reader_skip( Client *c )
+{
+      uint64_t end  = ring_published( c->ch );
+      uint64_t from = c->cursor;
+      if ( c->mid_line && !c->pend_len )
+      {
+            uint64_t eol = ring_line_end( c->ch, c->seg, from );
+            if ( eol - from <= MAX_KEEP && eol != end )
+            {
+                  char keep[ MAX_KEEP ];
+                  ring_span( c->seg, from, eol, keep );
+                  pend_append( c, keep, eol - from );
+                  from = eol;
+            }
+            else
+                  pend_append( c, "\n", 1 ); /* cut it short */
+      }
+
+      uint64_t resume = ring_line_end( c->ch, c->seg, end - queue_limit / 2 );
+      if ( resume <= from )
+            return;
+      unsigned long long lines = ring_span( c->seg, from, resume, NULL );
+
+      char marker[ 96 ];
+      int m = snprintf( marker, sizeof marker,
+                        "@nntmd dropped %llu lines (reader too slow)\n",
+                        lines );
+      pend_append( c, marker, (size_t)m );
+      c->dropped_lines += lines;
+      ++c->gaps;
+      COUNT( dropped_lines, lines );
+      CHAN_COUNT( c->ch, dropped_lines, lines );
+      COUNT( gaps, 1 );
+      V( "cli#%d dropped %llu lines\n", c->fd, lines );
+
+      reader_seek( c, resume );
+}
+
+/* Applies the overflow policy once c lags more than the limit, and lets
+ * writers go again once a blocking reader is back under half of it.
+ * Returns false if c was dropped. */
+static bool reader_check_lag( Client *c )
+{
+      size_t lag = (size_t)( ring_published( c->ch ) - c->cursor );
+      if ( lag > c->max_lag )
+            c->max_lag = lag;
+
+      if ( c->blocking && lag <= queue_limit / 2 )
+            reader_block( c, false );
+      if ( lag <= queue_limit )
+            return true;
+
+      switch ( overflow )
+      {
+      case OVF_DISCONNECT:
+            V( "cli#%d over its %zu B queue, disconnecting\n", c->fd,
+               queue_limit );
+            COUNT( slow_disconnects, 1 );
+            drop_client( c );
+            return false;
+      case OVF_BLOCK:
+            if ( !c->blocking )
+                  reader_block( c, true );
+            break;
+      case OVF_DROP:
+            reader_skip( c );
+            break;
+      }
+      return true;
+}
+
+/* Adds [from, to) of the ring to iov[] (at[] getting the stream offset of
+ * each entry), extending the last entry where the range continues it.
+ * Adds nothing and returns false if it might not fit. */
+static bool ring_range( Segment *s, uint64_t from, uint64_t to,
+                        struct iovec *iov, uint64_t *at, int *n, int max )
+{
+      if ( *n + (int)( ( to - from ) / SEG_SIZE ) + 2 > max )
+            return false;
+      for ( ; s && from < to; s = s->next )
+      {
+            uint64_t end = seg_end( s, to );
+            if ( from >= end )
+                  continue;
+            char *p = s->data + ( from - s->start );
+            if ( *n && at[ *n - 1 ] + iov[ *n - 1 ].iov_len == from &&
+                 (char *)iov[ *n - 1 ].iov_base + iov[ *n - 1 ].iov_len == p )
+                  iov[ *n - 1 ].iov_len += end - from;
+            else
+            {
+                  at[ *n ]    = from;
+                  iov[ *n ]   = (struct iovec){ p, end - from };
+                  ( *n )++;
+            }
+            from = end;
+      }
+      return true;
+}
+
+/* Queues the lines c subscribed to from its cursor on (first the rest of
+ * a line already partly sent). Returns the offset up to which lines were
+ * looked at, for c's cursor once everything queued has been sent. */
+static uint64_t reader_filter( Client *c, struct iovec *iov, uint64_t *at,
+                               int *n )
+{
+      Channel *ch  = c->ch;
+      uint64_t pos = c->cursor;
+      if ( c->mid_line )
+      {
+            uint64_t eol = ring_line_end( ch, c->seg, pos );
+            ring_range( c->seg, pos, eol, iov, at, n, FILTER_IOV );
+            pos = eol;
+      }
+
+      Segment *s = c->seg;
+      for ( size_t i = rec_find( ch, pos ); i < ch->num_recs; ++i )
+      {
+            LineRec *r   = rec_at( ch, i );
+            uint64_t end = i + 1 < ch->num_recs ? rec_at( ch, i + 1 )->off
+                                                : ch->ring_end;
+            if ( wanted( c, r->type ) )
+            {
+                  while ( r->off >= s->start + s->len )
+                        s = s->next;
+                  if ( !ring_range( s, r->off, end, iov, at, n, FILTER_IOV ) )
+                        break;
+            }
+            pos = end;
+      }
+      return pos;
+}
+
+/* Sends c's pending bytes and everything from its cursor to the end of the
+ * ring (or, subscribed, the lines it wants) with one writev, and waits for
+ * EPOLLOUT if the socket did not take it all. Returns false if c was
+ * dropped. */
+static bool reader_send( Client *c )
+{
+      reader_seek( c, c->cursor ); /* step onto a segment added since */
+
+      struct iovec iov[ FILTER_IOV ];
+      uint64_t at[ FILTER_IOV ]; /* stream offset of each ring entry */
+      int n = 0;
+      if ( c->pend_len )
+      {
+            at[ n ]    = 0;
+            iov[ n++ ] = (struct iovec){ c->pend, c->pend_len };
+      }
+      int first = n; /* first ring entry */
+
+      uint64_t end  = ring_published( c->ch );
+      uint64_t upto = c->cursor;
+      if ( c->wants )
+            upto = reader_filter( c, iov, at, &n );
+      else
+            for ( Segment *s = c->seg; upto < end && n < MAX_IOV; s = s->next )
+            {
+                  uint64_t to = seg_end( s, end );
+                  if ( upto >= to )
+                        continue;
+                  at[ n ]    = upto;
+                  iov[ n++ ] = (struct iovec){ s->data + ( upto - s->start ),
+                                               to - upto };
+                  upto       = to;
+            }
+
+      size_t total = 0;
+      for ( int k = 0; k < n; ++k )
+            total += iov[ k ].iov_len;
+
+      ssize_t w = n ? writev( c->fd, iov, n ) : 0;
+      c->writes += n > 0;
+      COUNT( writes, n > 0 );
+      if ( w == -1 && errno != EAGAIN && errno != EWOULDBLOCK &&
+           errno != EINTR )
+      {
+            drop_client( c ); /* real error */
+            return false;
+      }
+      if ( w == -1 || (size_t)w < total )
+            COUNT( write_eagain, 1 );
+
+      if ( w > 0 )
+      {
+            c->sent += (unsigned long long)w;
+            COUNT( bytes_out, (unsigned long long)w );
+
+            /* the last byte that went out decides mid_line */
+            size_t left = (size_t)w;
+            int k       = 0;
+            while ( left > iov[ k ].iov_len )
+                  left -= iov[ k++ ].iov_len;
+            c->mid_line = ( (char *)iov[ k ].iov_base )[ left - 1 ] != '\n';
+
+            size_t from_pend = (size_t)w < c->pend_len ? (size_t)w : c->pend_len;
+            memmove( c->pend, c->pend + from_pend, c->pend_len - from_pend );
+            c->pend_len -= from_pend;
+            if ( (size_t)w < total && k >= first )
+                  reader_seek( c, at[ k ] + left );
+      }
+      if ( w >= 0 && (size_t)w == total )
+            reader_seek( c, upto );
+
+      bool behind = c->pend_len || c->cursor < end;
+      if ( behind != c->out_armed )
+      {
+            c->out_armed = behind;
+            set_events( c, behind ? EPOLLIN | EPOLLOUT : EPOLLIN );
+      }
+      return true;
+}
+
+/* Sends what is new in the ring to each of the `*count` readers in
+ * `list`. Returns how many it got to. */
+static size_t serve_readers( Client **list, size_t *count )
+{
+      size_t sent = 0;
+      for ( size_t i = 0; i < *count; )
+      {
+            Client *c = list[ i ];
+            if ( c->disk_fd != -1 || c->shm )
+            {
+                  ++i; /* still reading the log, or reads on its own */
+                  continue;
+            }
+
+            /* a reader waiting for EPOLLOUT is caught up from there */
+            if ( ( !c->out_armed && !reader_send( c ) ) ||
+                 !reader_check_lag( c ) )
+                  continue; /* dropped; slot i now holds another reader */
+            ++sent;
+            ++i;
+      }
+      return sent;
+}
+
+/* Sends what was just added to the rings to every reader (the main
+ * loop's own, then the workers' by waking them up). */
+static void fanout( void )
+{
+      emit_flush();
+      fanout_due = false;
+      for ( size_t i = 0; i < num_channels; ++i )
+            channels[ i ]->fanned_end = channels[ i ]->ring_end;
+      ++fanouts;
+      if ( relay )
+      {
+            relay_flush();
+            return;
+      }
+
+      size_t sent = serve_readers( readers, &num_readers );
+      for ( size_t i = 0; i < num_channels; ++i )
+            ring_trim( channels[ i ] );
+      if ( shm_hdr )
+            shm_publish();
+      atomic_fetch_add_explicit( &fanout_gen, 1, memory_order_relaxed );
+      for ( int i = 0; i < num_workers; ++i )
+            if ( atomic_load_explicit( &workers[ i ].load,
+                                       memory_order_relaxed ) )
+                  wake( workers[ i ].wake_fd );
+
+      V( "    → delivered to %zu reader(s)\n", sent );
+}
+
+/* Reads the next whole records from c's log file and queues those of the
+ * types it subscribed to. Returns the bytes read, 0 at the end. */
+static ssize_t log_filter( Client *c )
+{
+      static char *buf;
+      static size_t cap;
+      buf = grow( buf, &cap, line_limit + REC_HDR_MAX, 1 ); /* longest record */
+
+      ssize_t n = pread( c->disk_fd, buf, cap, c->disk_off );
+      if ( n <= 0 )
+            return n;
+
+      const char *p = buf, *nl;
+      while ( ( nl = memchr( p, '\n', (size_t)( buf + n - p ) ) ) )
+      {
+            if ( wanted( c, line_type( p, (size_t)( nl - p ) ) ) )
+                  pend_append( c, p, (size_t)( nl - p ) + 1 );
+            p = nl + 1;
+      }
+      if ( p > buf )
+      {
+            c->disk_off += p - buf;
+            return p - buf;
+      }
+
+      /* a record longer than any written now (a larger -L before): skip
+       * all of it, up to its newline */
+      off_t off = c->disk_off + n;
+      while ( ( n = pread( c->disk_fd, buf, cap, off ) ) > 0 )
+      {
+            if ( ( nl = memchr( buf, '\n', (size_t)n ) ) )
+            {
+                  off += nl - buf + 1;
+                  break;
+            }
+            off += n;
+      }
+      ssize_t skipped = (ssize_t)( off - c->disk_off );
+      c->disk_off     = off;
+      return skipped;
+}
+
+/* EPOLLOUT while catching up from the log: sends up to CATCHUP_CHUNK
+ * more of it, file after file, and moves c onto the ring at the end of the
+ * newest file, which is where the ring ends too. */
+static void reader_catchup( Client *c )
+{
+      for ( size_t budget = CATCHUP_CHUNK; budget; )
+      {
+            if ( c->pend_len )
+            {
+                  ssize_t w = write( c->fd, c->pend, c->pend_len );
+                  COUNT( writes, 1 );
+                  if ( w == -1 )
+                  {
+                        if ( errno != EAGAIN && errno != EINTR )
+                              drop_client( c );
+                        else
+                              COUNT( write_eagain, 1 );
+                        return;
+                  }
+                  c->sent += (unsigned long long)w;
+                  COUNT( bytes_out, (unsigned long long)w );
+                  c->pend_len -= (size_t)w;
+                  memmove( c->pend, c->pend + w, c->pend_len );
+                  if ( c->pend_len )
+                        return;
+            }
+
+            ssize_t n = c->wants ? log_filter( c )
+                                 : sendfile( c->fd, c->disk_fd, &c->disk_off,
+                                             budget );
+            if ( !c->wants )
+                  COUNT( writes, 1 );
+            if ( n > 0 )
+            {
+                  if ( !c->wants )
+                  {
+                        c->sent += (unsigned long long)n;
+                        COUNT( bytes_out, (unsigned long long)n );
+                  }
+                  budget -= (size_t)n < budget ? (size_t)n : budget;
+                  continue;
+            }
+            if ( n == -1 )
+            {
+                  if ( errno != EAGAIN && errno != EINTR )
+                        drop_client( c );
+                  else
+                        COUNT( write_eagain, 1 );
+                  return;
+            }
+
+            /* end of this file */
+            close( c->disk_fd );
+            c->disk_fd = -1;
+            size_t i   = 0;
+            while ( i < log_nfiles && log_files[ i ].first_seq <= c->disk_seq )
+                  ++i;
+            if ( i == log_nfiles )
+            {
+                  V( "cli#%d ⇐ caught up from the log\n", c->fd );
+                  reader_attach( c );
+                  reader_send( c );
+                  return;
+            }
+
+            char path[ PATH_MAX ];
+            log_path( path, sizeof path, log_files[ i ].first_seq, "log" );
+            c->disk_fd = open( path, O_RDONLY | O_CLOEXEC );
+            if ( c->disk_fd == -1 )
+            {
+                  perror( path );
+                  drop_client( c );
+                  return;
+            }
+            c->disk_seq = log_files[ i ].first_seq;
+            c->disk_off = 0;
+      }
+}
+
+/* EPOLLOUT */
+static void reader_flush( Client *c )
+{
+      if ( relay )
+            relay_send( c );
+      else if ( c->disk_fd != -1 )
+            reader_catchup( c );
+      else if ( reader_send( c ) && reader_check_lag( c ) && !c->w )
+            ring_trim( c->ch );
+}
+
+static void dump_reader( const Client *c )
+{
+      if ( relay )
+      {
+            fprintf( stderr,
+                     "cli#%d reader: sent %llu B in %llu splices, queued %zu B "
+                     "(max %zu B)\n",
+                     c->fd, c->sent, c->writes, c->pipe_len, c->max_lag );
+            return;
+      }
+      if ( c->shm )
+      {
+            uint64_t pos = atomic_load_explicit(
+                &shm_hdr->slots[ c->shm_slot ].pos, memory_order_relaxed );
+            uint64_t end = main_ch.ring_end;
+            fprintf( stderr, "cli#%d reader: shared memory slot %d, lag %llu B\n",
+                     c->fd, c->shm_slot,
+                     (unsigned long long)( end > pos ? end - pos : 0 ) );
+            return;
+      }
+      if ( c->disk_fd != -1 )
+      {
+            fprintf( stderr,
+                     "cli#%d reader: sent %llu B, catching up from the log\n",
+                     c->fd, c->sent );
+            return;
+      }
+      fprintf( stderr,
+               "cli#%d reader: sent %llu B in %llu writes, lag %llu B "
+               "(max %zu B), dropped %llu lines in %llu gaps%s%s%s%s\n",
+               c->fd, c->sent, c->writes,
+               (unsigned long long)( ring_published( c->ch ) - c->cursor ),
+               c->max_lag, c->dropped_lines, c->gaps,
+               c->subs ? ", types=" : "", c->subs ? c->subs : "",
+               *c->ch->name ? ", chan=" : "", c->ch->name );
+}
+
+/* SIGUSR1: one line per client on stderr (each worker lists its own
+ * readers once it gets to it). */
+static void dump_counters( void )
+{
+      size_t segments = 0;
+      for ( size_t i = 0; i < num_channels; ++i )
+            segments += ring_segments( channels[ i ] );
+      fprintf( stderr,
+               "srv: %zu readers, %zu writers, %zu pending, ring %zu KiB, "
+               "%zu types, %llu fanouts%s\n",
+               total_readers(), num_writers, num_pending,
+               segments * SEG_SIZE / 1024,
+               num_types, fanouts, main_ch.paused ? " (writers paused)" : "" );
+      for ( size_t i = 1; i < num_channels; ++i )
+      {
+            Channel *ch = channels[ i ];
+            fprintf( stderr,
+                     "chan %s: %zu readers, %zu writers, received %llu B, "
+                     "ring %zu KiB%s\n",
+                     ch->name, atomic_load( &ch->readers ), ch->writers,
+                     (unsigned long long)atomic_load( &ch->bytes_in ),
+                     ring_segments( ch ) * SEG_SIZE / 1024,
+                     ch->paused ? " (writers paused)" : "" );
+      }
+      if ( log_dir )
+            fprintf( stderr, "srv: log %zu file(s) in %s, next seq %llu\n",
+                     log_nfiles, log_dir, (unsigned long long)main_ch.next_seq );
+      for ( size_t i = 0; i < num_readers; ++i )
+            dump_reader( readers[ i ] );
+      for ( size_t i = 0; i < num_writers; ++i )
+      {
+            Client *c = writers[ i ];
+            fprintf( stderr,
+                     "cli#%d writer: received %llu B, %llu over-long lines "
+                     "cut",
+                     c->fd, c->bytes_in, c->long_lines );
+            if ( c->rate )
+                  fprintf( stderr,
+                           ", %zu B/s: held %llu ms, %llu lines dropped%s",
+                           c->rate, c->held_ms, c->rate_dropped,
+                           c->held ? " (held now)" : "" );
+            fputc( '\n', stderr );
+      }
+      for ( int i = 0; i < num_workers; ++i )
+      {
+            atomic_store( &workers[ i ].dump, true );
+            wake( workers[ i ].wake_fd );
+      }
+}
+
+/* ─────────────────── writer rate limits (-r) ─────────────── */
+
+/* Each writer may send `rate` bytes a second, in bursts of up to `burst`.
+ * One that has used its bucket up is either held (-O pause, the default:
+ * left unread, so its own write()s block, until HOLD_BYTES have come
+ * back) or read and thrown away a line at a time (-O drop). Either way
+ * the others are still read at their pace, and the stream gets a
+ * summary line for it at most once a second. */
+
+static void bucket_set( Client *c, size_t rate )
+{
+      c->rate      = rate;
+      c->burst     = writer_burst ? writer_burst : rate;
+      c->tokens    = (int64_t)c->burst;
+      c->filled_at = now_us();
+}
+
+static void bucket_fill( Client *c )
+{
+      uint64_t now = now_us();
+      uint64_t dt  = now - c->filled_at;
+      int64_t add  = (int64_t)( ( dt < 10000000 ? dt : 10000000 ) * c->rate /
+                                1000000 );
+      if ( !add )
+            return; /* let it build up to a whole byte */
+      c->tokens    = c->tokens + add < (int64_t)c->burst ? c->tokens + add
+                                                           : (int64_t)c->burst;
+      c->filled_at = now;
+}
+
+/* How much to read from writer c now: its share of this pass, less if
+ * its bucket holds less (0: hold it). */
+static size_t writer_quota( Client *c, size_t share )
+{
+      if ( !c->rate || rate_drop )
+            return share;
+      bucket_fill( c );
+      if ( c->tokens <= 0 )
+            return 0;
+      return (size_t)c->tokens < share ? (size_t)c->tokens : share;
+}
+
+/* Charges `len` bytes read from c to its bucket; false when they are to
+ * be thrown away instead (-O drop, nothing left in it). */
+static bool writer_admit( Client *c, size_t len )
+{
+      if ( !c->rate )
+            return true;
+      bucket_fill( c );
+      if ( c->tokens <= 0 && rate_drop )
+            return false;
+      c->tokens -= (int64_t)len;
+      return true;
+}
+
+/* Sends the summary line for what c's rate has cost it since the last
+ * one, at most once a second unless it is the last. */
+static void writer_note( Client *c, bool last )
+{
+      if ( !c->unnoted_ms && !c->unnoted_lines )
+            return;
+      uint64_t now = now_ms();
+      if ( !last && now - c->noted_at < 1000 )
+            return;
+
+      char line[ 128 ];
+      int n = c->unnoted_lines
+                  ? snprintf( line, sizeof line,
+                              "@nntmd dropped %llu lines from cli#%d (over "
+                              "%zu B/s)\n",
+                              c->unnoted_lines, c->fd, c->rate )
+                  : snprintf( line, sizeof line,
+                              "@nntmd held cli#%d back for %llu ms (over "
+                              "%zu B/s)\n",
+                              c->fd, c->unnoted_ms, c->rate );
+      V( "srv: %s", line + 7 );
+      emit( c->ch, line, (size_t)n );
+      fanout_soon( c->ch );
+      c->unnoted_ms    = 0;
+      c->unnoted_lines = 0;
+      c->noted_at      = now;
+}
+
+/* Throws away `len` bytes c sent over its rate, with the line it had
+ * started: whatever follows up to the next newline goes too. */
+static void writer_discard( Client *c, size_t len, size_t lines, bool mid )
+{
+      c->bytes_in += len;
+      COUNT( bytes_in, len );
+      CHAN_COUNT( c->ch, bytes_in, len );
+      c->rate_dropped += lines;
+      c->unnoted_lines += lines;
+      COUNT( rate_dropped, lines );
+      c->part_len = 0;
+      c->skipping = mid;
+      writer_note( c, false );
+}
+
+static void writer_hold( Client *c )
+{
+      if ( c->held )
+            return;
+      int64_t need = c->burst < HOLD_BYTES ? (int64_t)c->burst : HOLD_BYTES;
+      uint64_t ms  = (uint64_t)( need - c->tokens ) * 1000 / c->rate;
+      c->held       = true;
+      c->held_at    = now_ms();
+      c->held_until = c->held_at + ( ms ? ms : 1 );
+      if ( c->held_until < held_due )
+            held_due = c->held_until;
+      ++num_held;
+      COUNT( holds, 1 );
+      set_events( c, 0 );
+}
+
+static void writer_release( Client *c, uint64_t now )
+{
+      c->held = false;
+      --num_held;
+      c->held_ms += now - c->held_at;
+      c->unnoted_ms += now - c->held_at;
+      if ( !c->ch->paused )
+            set_events( c, EPOLLIN );
+      writer_note( c, false );
+}
+
+/* Reads writers again whose buckets have refilled. */
+static void release_writers( uint64_t now )
+{
+      held_due = UINT64_MAX;
+      for ( size_t i = 0; i < num_writers && num_held; ++i )
+      {
+            Client *c = writers[ i ];
+            if ( !c->held )
+                  continue;
+            if ( c->held_until <= now )
+                  writer_release( c, now );
+            else if ( c->held_until < held_due )
+                  held_due = c->held_until;
+      }
+}
+
+/* Options after "WRITER": rate=<bytes/s> slows it down below -r,
+ * chan=<name> sends it to that channel. Returns false if c was dropped. */
+static bool writer_options( Client *c, char *opts )
+{
+      for ( char *tok = strtok( opts, " " ); tok; tok = strtok( NULL, " " ) )
+            if ( !strncmp( tok, "rate=", 5 ) )
+            {
+                  size_t rate = (size_t)strtoull( tok + 5, NULL, 10 );
+                  if ( rate && ( !writer_rate || rate < writer_rate ) )
+                        bucket_set( c, rate );
+            }
+            else if ( !strncmp( tok, "chan=", 5 ) &&
+                      !channel_join( c, tok + 5 ) )
+                  return false;
+      return true;
+}
+
+/* ──────────────────────── writer input ───────────────────── */
+
+/* Emits whole lines, cutting any longer than line_limit
+ * (the fast path when the whole run fits, as it does by default). */
+static void forward_lines( Client *c, const char *p, size_t len )
+{
+      if ( len <= line_limit )
+      {
+            emit( c->ch, p, len );
+            return;
+      }
+
+      const char *end = p + len;
+      while ( p < end )
+      {
+            const char *nl = memchr( p, '\n', (size_t)( end - p ) );
+            size_t n       = (size_t)( nl - p ) + 1;
+            if ( n > line_limit )
+            {
+                  emit( c->ch, p, line_limit - 1 );
+                  emit( c->ch, "\n", 1 );
+                  ++c->long_lines;
+                  COUNT( long_lines, 1 );
+            }
+            else
+                  emit( c->ch, p, n );
+            p = nl + 1;
+      }
+}
+
+/* Adds `len` unterminated bytes to c's pending line. A line that outgrows
+ * line_limit is forwarded cut at the limit and the rest of it skipped. */
+static bool pending_append( Client *c, const char *p, size_t len )
+{
+      if ( c->part_len + len < line_limit )
+      {
+            c->part = grow( c->part, &c->part_cap, c->part_len + len, 1 );
+            memcpy( c->part + c->part_len, p, len );
+            c->part_len += len;
+            return false;
+      }
+
+      emit( c->ch, c->part, c->part_len );
+      emit( c->ch, p, line_limit - 1 - c->part_len );
+      emit( c->ch, "\n", 1 );
+      ++c->long_lines;
+      COUNT( long_lines, 1 );
+      c->part_len = 0;
+      c->skipping = true;
+      return true;
+}
+
+/* Schedules a fanout for the end of this loop iteration, or up to
+ * coalesce_ms later if little has come in yet (on ch, which just got
+ * some). */
+static void fanout_soon( Channel *ch )
+{
+      if ( !fanout_due )
+      {
+            fanout_due = true;
+            fanout_at  = now_ms() + (uint64_t)coalesce_ms;
+      }
+      if ( ch->ring_end - ch->fanned_end + ch->stage_len >= queue_limit / 4 )
+            fanout_at = 0; /* enough to be worth sending now */
+}
+
+/* Splits a writer's input into lines: each read forwards all the whole
+ * lines it completed as one batch, an unfinished line waits in the
+ * writer's own buffer, so concurrent writers never splice mid-line. */
+static void writer_input( Client *c, const char *p, size_t len )
+{
+      const char *end = p + len;
+      bool any        = false;
+      size_t lines    = count_lines( p, len );
+
+      c->bytes_in += len;
+      c->lines_in += lines;
+      COUNT( bytes_in, len );
+      COUNT( lines_in, lines );
+      CHAN_COUNT( c->ch, bytes_in, len );
+      CHAN_COUNT( c->ch, lines_in, lines );
+
+      if ( c->skipping )
+      {
+            const char *nl = memchr( p, '\n', len );
+            if ( !nl )
+                  return;
+            p           = nl + 1;
+            c->skipping = false;
+      }
+
+      /* finish the pending line first */
+      if ( c->part_len && p < end )
+      {
+            const char *nl = memchr( p, '\n', (size_t)( end - p ) );
+            size_t n       = nl ? (size_t)( nl - p ) + 1 : (size_t)( end - p );
+            if ( pending_append( c, p, n ) )
+            {
+                  any         = true;
+                  c->skipping = !nl;
+            }
+            else if ( nl )
+            {
+                  emit( c->ch, c->part, c->part_len );
+                  c->part_len = 0;
+                  any         = true;
+            }
+            p += n;
+      }
+
+      if ( !c->skipping && p < end )
+      {
+            const char *last = memrchr( p, '\n', (size_t)( end - p ) );
+            if ( last )
+            {
+                  forward_lines( c, p, (size_t)( last - p ) + 1 );
+                  p   = last + 1;
+                  any = true;
+            }
+            if ( p < end && pending_append( c, p, (size_t)( end - p ) ) )
+                  any = true;
+      }
+
+      if ( any )
+            fanout_soon( c->ch );
+}
+
+/* A writer that hangs up mid-line still gets its last line out. */
+static void writer_eof( Client *c )
+{
+      if ( !c->part_len )
+            return;
+      emit( c->ch, c->part, c->part_len );
+      emit( c->ch, "\n", 1 );
+      c->part_len = 0;
+      fanout_soon( c->ch );
+}
+
+/* A packet writer sends a line per message, so there is nothing to
+ * reassemble: up to MAX_PACKETS of them come in with one recvmmsg, are
+ * closed up (each with its newline, added if it lacks one) and emitted
+ * as one batch. An empty message is the end of the connection. */
+static void packet_input( Client *c )
+{
+      static char *buf;
+      static size_t cap;
+      static struct mmsghdr msgs[ MAX_PACKETS ];
+      static struct iovec iov[ MAX_PACKETS ];
+
+      size_t max = PACKET_BUF / line_limit;
+      max        = max < 1 ? 1 : max > MAX_PACKETS ? MAX_PACKETS : max;
+      buf        = grow( buf, &cap, max * line_limit, 1 );
+      for ( size_t i = 0; i < max; ++i )
+      {
+            iov[ i ]  = (struct iovec){ buf + i * line_limit, line_limit };
+            msgs[ i ] = (struct mmsghdr){
+                .msg_hdr = { .msg_iov = &iov[ i ], .msg_iovlen = 1 } };
+      }
+
+      int n = recvmmsg( c->fd, msgs, (unsigned)max, MSG_DONTWAIT, NULL );
+      if ( n == -1 )
+      {
+            if ( errno == EAGAIN )
+                  COUNT( read_eagain, 1 );
+            else if ( errno != EINTR )
+                  drop_client( c );
+            return;
+      }
+
+      int k        = 0;
+      char *end    = buf;
+      size_t bytes = 0;
+      for ( ; k < n && msgs[ k ].msg_len; ++k )
+      {
+            char *p    = iov[ k ].iov_base;
+            size_t len = msgs[ k ].msg_len;
+            bytes += len;
+            if ( p[ len - 1 ] == '\n' )
+                  --len;
+            if ( len >= line_limit || msgs[ k ].msg_hdr.msg_flags & MSG_TRUNC )
+            {
+                  len = line_limit - 1;
+                  ++c->long_lines;
+                  COUNT( long_lines, 1 );
+            }
+            memmove( end, p, len );
+            end[ len ] = '\n';
+            end += len + 1;
+      }
+      if ( k && !writer_admit( c, bytes ) )
+            writer_discard( c, bytes, (size_t)k, false );
+      else if ( k )
+      {
+            c->bytes_in += bytes;
+            c->lines_in += (unsigned long long)k;
+            COUNT( bytes_in, bytes );
+            COUNT( lines_in, (unsigned long long)k );
+            CHAN_COUNT( c->ch, bytes_in, bytes );
+            CHAN_COUNT( c->ch, lines_in, (unsigned long long)k );
+            V( "cli#%d → %d messages\n", c->fd, k );
+            emit( c->ch, buf, (size_t)( end - buf ) );
+            fanout_soon( c->ch );
+      }
+      if ( k < n )
+            drop_client( c ); /* EOF */
+}
+
+/* ──────────────────────── relay (-Z) ─────────────────────── */
+
+/* With -Z writer bytes are relayed without being looked at: spliced from
+ * the writer's socket into relay_pipe, then at fanout tee()d into each
+ * reader's own pipe (which only takes references to the same pages) and
+ * spliced from there to its socket. Nothing passes through user space,
+ * but nothing is framed either: lines from concurrent writers are not
+ * kept whole, and with no ring there are no replays, no types= and no
+ * log. */
+
+/* Makes a non-blocking pipe of up to `want` bytes, as large as allowed. */
+static bool pipe_open( int fds[ 2 ], size_t want )
+{
+      if ( pipe2( fds, O_NONBLOCK | O_CLOEXEC ) == -1 )
+            return false;
+      for ( size_t sz = want; sz > 64 * 1024; sz /= 2 )
+            if ( fcntl( fds[ 1 ], F_SETPIPE_SZ, (int)sz ) != -1 )
+                  break;
+      return true;
+}
+
+static void relay_open( void )
+{
+      /* a batch is sent once it reaches a quarter of -q, as without -Z */
+      if ( !pipe_open( relay_pipe, queue_limit / 4 ) )
+            die( "pipe2" );
+      relay_cap = (size_t)fcntl( relay_pipe[ 1 ], F_GETPIPE_SZ );
+      null_fd   = open( "/dev/null", O_WRONLY | O_CLOEXEC );
+      if ( null_fd == -1 )
+            die( "/dev/null" );
+}
+
+/* Splices what c's pipe holds on to its socket. Returns false if c was
+ * dropped. */
+static bool relay_send( Client *c )
+{
+      while ( c->pipe_len )
+      {
+            ssize_t w = splice( c->pipe_fd[ 0 ], NULL, c->fd, NULL,
+                                c->pipe_len,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+            COUNT( writes, 1 );
+            if ( w == -1 && errno == EINTR )
+                  continue;
+            if ( w == -1 && errno == EAGAIN )
+            {
+                  COUNT( write_eagain, 1 );
+                  break;
+            }
+            if ( w <= 0 )
+            {
+                  drop_client( c );
+                  return false;
+            }
+            c->pipe_len -= (size_t)w;
+            c->sent += (unsigned long long)w;
+            ++c->writes;
+            COUNT( bytes_out, (unsigned long long)w );
+      }
+
+      bool behind = c->pipe_len != 0;
+      if ( behind != c->out_armed )
+      {
+            c->out_armed = behind;
+            set_events( c, behind ? EPOLLIN | EPOLLOUT : EPOLLIN );
+      }
+      return true;
+}
+
+/* Fanout with -Z: tees relay_pipe into every reader's pipe, empties it
+ * and sends on what each reader can take. A reader that would fall more
+ * than -q behind (or whose pipe has no room left) is hung up on, whatever
+ * -o says: dropping would leave a hole somewhere in a line, and a pipe
+ * cannot tell where lines start. */
+static void relay_flush( void )
+{
+      size_t sent = 0;
+      for ( size_t i = 0; relay_pend && i < num_readers; )
+      {
+            Client *c = readers[ i ];
+            ssize_t k = c->pipe_len + relay_pend > queue_limit
+                            ? 0
+                            : tee( relay_pipe[ 0 ], c->pipe_fd[ 1 ],
+                                   relay_pend, SPLICE_F_NONBLOCK );
+            if ( k != (ssize_t)relay_pend )
+            {
+                  V( "cli#%d ✗ fell %zu B behind, disconnecting\n", c->fd,
+                     c->pipe_len );
+                  COUNT( slow_disconnects, 1 );
+                  drop_client( c );
+                  continue; /* slot i now holds another reader */
+            }
+            c->pipe_len += relay_pend;
+            if ( c->pipe_len > c->max_lag )
+                  c->max_lag = c->pipe_len;
+            if ( !c->out_armed && !relay_send( c ) )
+                  continue;
+            ++sent;
+            ++i;
+      }
+
+      while ( relay_pend )
+      {
+            ssize_t n = splice( relay_pipe[ 0 ], NULL, null_fd, NULL,
+                                relay_pend, 0 );
+            if ( n <= 0 )
+                  die( "splice" );
+            relay_pend -= (size_t)n;
+      }
+      V( "    → relayed to %zu reader(s)\n", sent );
+}
+
+/* A writer's input with -Z, moved into relay_pipe as it is. */
+static void relay_input( Client *c, size_t share )
+{
+      if ( relay_pend + BUF_SIZE > relay_cap )
+            fanout(); /* make room first */
+
+      ssize_t n = splice( c->fd, NULL, relay_pipe[ 1 ], NULL, share,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+      if ( n == -1 && errno == EAGAIN && relay_pend )
+      {
+            /* out of pipe slots rather than of input (every write a
+             * writer made may take one) */
+            fanout();
+            n = splice( c->fd, NULL, relay_pipe[ 1 ], NULL, share,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+      }
+      if ( n <= 0 )
+      {
+            if ( n == -1 && errno == EAGAIN )
+                  COUNT( read_eagain, 1 );
+            if ( n == -1 && ( errno == EINTR || errno == EAGAIN ) )
+                  return;
+            drop_client( c ); /* EOF / error */
+            return;
+      }
+      V( "cli#%d → %zd bytes (relayed)\n", c->fd, n );
+      c->bytes_in += (unsigned long long)n;
+      COUNT( bytes_in, (unsigned long long)n );
+      CHAN_COUNT( c->ch, bytes_in, (unsigned long long)n );
+      relay_pend += (size_t)n;
+      fanout_soon( c->ch );
+}
+
+/* Bytes a writer sent with its handshake, relayed like the rest. */
+static void relay_bytes( Client *c, const char *p, size_t len )
+{
+      if ( relay_pend + len > relay_cap )
+            fanout();
+      if ( write( relay_pipe[ 1 ], p, len ) != (ssize_t)len )
+      {
+            drop_client( c );
+            return;
+      }
+      c->bytes_in += len;
+      COUNT( bytes_in, len );
+      CHAN_COUNT( c->ch, bytes_in, len );
+      relay_pend += len;
+      fanout_soon( c->ch );
+}
+
+/* ─────────────────────── connections ─────────────────────── */
+
+/* Sequence number of the record at stream offset `off` of ch's ring. */
+static uint64_t ring_seq_at( Channel *ch, uint64_t off )
+{
+      char rec[ REC_HDR_MAX ];
+      uint64_t end = ch->ring_end;
+      uint64_t to  = end - off < sizeof rec ? end : off + sizeof rec;
+      ring_span( ch->ring_head, off, to, rec );
+      return record_seq( rec, (size_t)( to - off ) );
+}
+
+/* Stream offset of record `seq` in ch's ring, or UINT64_MAX if the ring
+ * does not hold it; numbers only grow along the line index. */
+static uint64_t ring_find_seq( Channel *ch, uint64_t seq )
+{
+      size_t lo = 0, hi = ch->num_recs;
+      while ( lo < hi )
+      {
+            size_t mid = lo + ( hi - lo ) / 2;
+            if ( ring_seq_at( ch, rec_at( ch, mid )->off ) < seq )
+                  lo = mid + 1;
+            else
+                  hi = mid;
+      }
+      if ( lo == ch->num_recs ||
+           ring_seq_at( ch, rec_at( ch, lo )->off ) != seq )
+            return UINT64_MAX;
+      return rec_at( ch, lo )->off;
+}
+
+/* The channel called `name`, made on first use; NULL for a name that is
+ * not [A-Za-z0-9._-]+ of under MAX_CHAN bytes, or one too many. */
+static Channel *channel_get( const char *name )
+{
+      size_t len = strspn( name, "abcdefghijklmnopqrstuvwxyz"
+                                 "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-" );
+      if ( !len || name[ len ] || len >= MAX_CHAN )
+            return NULL;
+      for ( size_t i = 1; i < num_channels; ++i )
+            if ( !strcmp( channels[ i ]->name, name ) )
+                  return channels[ i ];
+      if ( num_channels == MAX_CHANNELS )
+            return NULL;
+
+      Channel *ch = calloc( 1, sizeof *ch );
+      if ( !ch )
+            die( "calloc" );
+      memcpy( ch->name, name, len + 1 );
+      ch->next_seq               = 1;
+      channels[ num_channels++ ] = ch;
+      V( "srv: channel %s opened\n", name );
+      return ch;
+}
+
+/* Moves c over to the channel named in its handshake: a reader before
+ * set_role() attaches it to a ring, a writer once registered. Returns
+ * false, having hung up on it, if it cannot be. */
+static bool channel_join( Client *c, const char *name )
+{
+      Channel *ch = relay ? NULL : channel_get( name );
+      if ( !ch )
+      {
+            V( "cli#%d ✗ no channel %s%s\n", c->fd, name,
+               relay ? " with -Z" : "" );
+            drop_client( c );
+            return false;
+      }
+      if ( !c->hello )
+      {
+            --c->ch->writers;
+            ++ch->writers;
+            set_events( c, ch->paused ? 0 : EPOLLIN );
+      }
+      c->ch = ch;
+      return true;
+}
+
+/* READER since=<seq>: starts c at record `seq`, from the ring if it is
+ * still there and not too far back, else from the log files. Lines that
+ * have expired from the log are replaced by a marker. */
+static void reader_resume( Client *c, uint64_t seq )
+{
+      if ( seq >= main_ch.next_seq )
+            return; /* nothing that old yet: live */
+
+      uint64_t pos = ring_find_seq( &main_ch, seq );
+      if ( pos != UINT64_MAX && main_ch.ring_end - pos <= queue_limit )
+      {
+            reader_rewind( c, pos );
+            if ( reader_send( c ) )
+                  reader_check_lag( c );
+            return;
+      }
+
+      if ( seq < log_files[ 0 ].first_seq )
+      {
+            char marker[ 96 ];
+            int m = snprintf( marker, sizeof marker,
+                              "@nntmd lines %llu..%llu expired\n",
+                              (unsigned long long)seq,
+                              (unsigned long long)log_files[ 0 ].first_seq - 1 );
+            pend_append( c, marker, (size_t)m );
+            seq = log_files[ 0 ].first_seq;
+      }
+      size_t i = 0;
+      while ( i + 1 < log_nfiles && log_files[ i + 1 ].first_seq <= seq )
+            ++i;
+
+      char path[ PATH_MAX ];
+      log_path( path, sizeof path, log_files[ i ].first_seq, "log" );
+      int fd = open( path, O_RDONLY | O_CLOEXEC );
+      if ( fd == -1 )
+      {
+            perror( path );
+            return;
+      }
+      c->disk_fd  = fd;
+      c->disk_seq = log_files[ i ].first_seq;
+      c->disk_off = log_find( i, seq );
+      --c->seg->refs;
+      c->seg       = NULL;
+      c->out_armed = true;
+      set_events( c, EPOLLIN | EPOLLOUT );
+      V( "cli#%d ⇐ resuming at seq %llu from the log\n", c->fd,
+         (unsigned long long)seq );
+}
+
+/* Parses the options after "READER" (space separated, unknown ones are
+ * ignored). Returns the number of backlog lines asked for; since=<seq>
+ * (a sequence number to resume from) goes to *seq, types=<list> to
+ * *types, chan=<name> to *chan, and "shm" (to read the shared memory
+ * ring) to *shm. */
+static size_t reader_options( char *opts, uint64_t *seq, const char **types,
+                              const char **chan, bool *shm )
+{
+      size_t since = 0;
+      for ( char *tok = strtok( opts, " " ); tok; tok = strtok( NULL, " " ) )
+            if ( !strncmp( tok, "since=-", 7 ) )
+                  since = (size_t)strtoul( tok + 7, NULL, 10 );
+            else if ( !strncmp( tok, "since=", 6 ) )
+                  *seq = strtoull( tok + 6, NULL, 10 );
+            else if ( !strncmp( tok, "types=", 6 ) )
+                  *types = tok + 6;
+            else if ( !strncmp( tok, "chan=", 5 ) )
+                  *chan = tok + 5;
+            else if ( !strcmp( tok, "shm" ) )
+                  *shm = true;
+      return since;
+}
+
+/* Where in the shared ring a reader asking for `since` lines or record
+ * `seq` starts, or UINT64_MAX when that is not in it (or too far back to
+ * leave it room): it is then served on its socket instead. */
+static uint64_t shm_start( size_t since, uint64_t seq )
+{
+      if ( since && log_dir ) /* as far back as the log goes, see below */
+      {
+            seq = main_ch.next_seq > since ? main_ch.next_seq - since : 1;
+            if ( seq < log_files[ 0 ].first_seq )
+                  seq = log_files[ 0 ].first_seq;
+      }
+      uint64_t end  = main_ch.ring_end;
+      uint64_t from = end;
+      if ( seq && numbered )
+            from = seq >= main_ch.next_seq ? end : ring_find_seq( &main_ch, seq );
+      else if ( since )
+            from = ring_backlog( &main_ch, since );
+      return from != UINT64_MAX && end - from <= shm_size / 2 ? from
+                                                             : UINT64_MAX;
+}
+
+/* Registers c as a reader of the shared ring from `from` on: replies
+ * "OK[ seq] shm <slot> <from>" with the memfd and an eventfd attached.
+ * Returns false, having sent nothing, if it cannot. */
+static bool reader_shm( Client *c, uint64_t from )
+{
+      int slot = shm_slot_take();
+      if ( slot == -1 )
+            return false;
+      int efd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+      if ( efd == -1 )
+      {
+            shm_used[ slot / 64 ] &= ~( 1ull << ( slot % 64 ) );
+            return false;
+      }
+      ShmSlot *sl = &shm_hdr->slots[ slot ];
+      atomic_store( &sl->sleeping, 0 );
+      atomic_store( &sl->pos, from );
+
+      char reply[ 64 ];
+      int len = snprintf( reply, sizeof reply, "OK%s shm %d %llu\n",
+                          numbered ? " seq" : "", slot,
+                          (unsigned long long)from );
+      int fds[ 2 ] = { shm_fd, efd };
+      union
+      {
+            struct cmsghdr h;
+            char buf[ CMSG_SPACE( sizeof fds ) ];
+      } u;
+      struct iovec iov  = { reply, (size_t)len };
+      struct msghdr msg = { .msg_iov        = &iov,
+                            .msg_iovlen     = 1,
+                            .msg_control    = u.buf,
+                            .msg_controllen = sizeof u.buf };
+      struct cmsghdr *cm = CMSG_FIRSTHDR( &msg );
+      cm->cmsg_level     = SOL_SOCKET;
+      cm->cmsg_type      = SCM_RIGHTS;
+      cm->cmsg_len       = CMSG_LEN( sizeof fds );
+      memcpy( CMSG_DATA( cm ), fds, sizeof fds );
+
+      c->shm      = true; /* drop_client() gives the slot back */
+      c->shm_slot = slot;
+      c->shm_efd  = efd;
+      set_role( c, true );
+      --c->seg->refs; /* holds no place in the broadcast ring */
+      c->seg = NULL;
+      if ( sendmsg( c->fd, &msg, MSG_NOSIGNAL ) != len )
+            drop_client( c );
+      else
+            V( "cli#%d ⇒ reading shared memory slot %d from %llu\n", c->fd,
+               slot, (unsigned long long)from );
+      return true;
+}
+
+/* A reader's handshake line (NUL terminated, without its newline): the
+ * reply, then whatever history it asked for. */
+static void reader_hello( Client *c, char *line )
+{
+      uint64_t seq      = 0;
+      const char *types = NULL;
+      const char *chan  = NULL;
+      bool shm          = false;
+      size_t since = reader_options( line + 6, &seq, &types, &chan, &shm );
+      if ( chan && !channel_join( c, chan ) )
+            return;
+      Channel *ch = c->ch;
+
+      /* the shared ring has every line, so subscribed readers stay here */
+      uint64_t from = shm && shm_hdr && !types && ch == &main_ch
+                          ? shm_start( since, seq )
+                          : UINT64_MAX;
+      if ( from != UINT64_MAX && reader_shm( c, from ) )
+            return;
+      if ( relay && types )
+      {
+            V( "cli#%d ✗ types= needs the lines framed, not so with -Z\n",
+               c->fd );
+            drop_client( c );
+            return;
+      }
+      /* room for -q bytes even in the page or so each write of a writer
+       * takes in a pipe */
+      if ( relay && !pipe_open( c->pipe_fd, 4 * queue_limit ) )
+      {
+            drop_client( c );
+            return;
+      }
+
+      /* "OK seq": lines come numbered, resumable by since=<seq> */
+      bool logged = log_dir && ch == &main_ch;
+      if ( ch == &main_ch ? numbered : stamp_time )
+            write( c->fd, "OK seq\n", 7 );
+      else
+            write( c->fd, "OK\n", 3 );
+      set_role( c, true );
+      if ( relay )
+            return; /* live bytes only: nothing is kept to replay */
+
+      if ( types )
+            reader_subscribe( c, types );
+      if ( seq && logged )
+            reader_resume( c, seq );
+      else if ( since && logged )
+      {
+            /* the log reaches back further than the ring */
+            seq = main_ch.next_seq > since ? main_ch.next_seq - since : 1;
+            if ( seq < log_files[ 0 ].first_seq )
+                  seq = log_files[ 0 ].first_seq;
+            reader_resume( c, seq );
+      }
+      else if ( seq && stamp_time )
+      {
+            /* -T only: as far as the ring goes, the viewer sees the gap */
+            uint64_t oldest = ring_backlog( ch, backlog_lines );
+            uint64_t from   = seq >= ch->next_seq ? ch->ring_end
+                                                  : ring_find_seq( ch, seq );
+            reader_rewind( c, from == UINT64_MAX || from < oldest ? oldest
+                                                                 : from );
+            if ( reader_send( c ) )
+                  reader_check_lag( c );
+      }
+      else if ( since )
+      {
+            reader_rewind( c, ring_backlog( ch, since ) );
+            if ( reader_send( c ) )
+                  reader_check_lag( c );
+      }
+}
+
+/* Reads what a pending client has sent so far and, once its first line
+ * is in (or what came cannot be the start of a handshake), registers it:
+ * "READER[ <options>]" as a reader, "WRITER" or anything else as a
+ * writer, which is then sent what followed as input. */
+static void pending_input( Client *c )
+{
+      ssize_t n = read( c->fd, c->hello + c->hello_len,
+                        HELLO_MAX - c->hello_len );
+      if ( n <= 0 )
+      {
+            if ( n == -1 && ( errno == EINTR || errno == EAGAIN ) )
+                  return;
+            drop_client( c ); /* gone before saying anything useful */
+            return;
+      }
+      c->hello_len += (size_t)n;
+
+      char h[ HELLO_MAX + 1 ]; /* c->hello goes with set_role() */
+      size_t len = c->hello_len;
+      memcpy( h, c->hello, len );
+      char *nl    = memchr( h, '\n', len );
+      bool reader = len >= 7 && !memcmp( h, "READER", 6 ) &&
+                    ( h[ 6 ] == '\n' || h[ 6 ] == ' ' );
+      bool writer = len >= 7 && !memcmp( h, "WRITER", 6 ) &&
+                    ( h[ 6 ] == '\n' || h[ 6 ] == ' ' );
+      if ( reader && nl )
+      {
+            *nl = '\0';
+            reader_hello( c, h );
+            return; /* anything after it is ignored, as from any reader */
+      }
+      if ( reader || ( writer && !nl ) ||
+           ( len < 7 && ( !memcmp( h, "READER ", len ) ||
+                          !memcmp( h, "WRITER\n", len ) ) ) )
+      {
+            if ( len == HELLO_MAX )
+            {
+                  V( "cli#%d handshake too long\n", c->fd );
+                  COUNT( hello_too_long, 1 );
+                  drop_client( c );
+            }
+            return; /* wait for the rest of it */
+      }
+
+      size_t skip = writer ? (size_t)( nl - h ) + 1 : 0;
+      set_role( c, false );
+      if ( writer )
+      {
+            *nl = '\0';
+            if ( !writer_options( c, h + 6 ) )
+                  return;
+            write( c->fd, "OK\n", 3 );
+      }
+      if ( len > skip )
+      {
+            V( "cli#%d → %zu bytes\n", c->fd, len - skip );
+            if ( relay )
+                  relay_bytes( c, h + skip, len - skip );
+            else if ( writer_admit( c, len - skip ) )
+                  writer_input( c, h + skip, len - skip );
+            else
+                  writer_discard( c, len - skip,
+                                  count_lines( h + skip, len - skip ),
+                                  h[ len - 1 ] != '\n' );
+      }
+}
+
+/* Gives up on handshakes that took longer than hello_ms: a connection
+ * that has sent nothing yet is taken for a quiet writer, one that has
+ * started a handshake is hung up on. */
+static void expire_pending( uint64_t now )
+{
+      pending_due = UINT64_MAX;
+      for ( size_t i = 0; i < num_pending; )
+      {
+            Client *c = pending[ i ];
+            if ( c->hello_by > now )
+            {
+                  if ( c->hello_by < pending_due )
+                        pending_due = c->hello_by;
+                  ++i;
+                  continue;
+            }
+            V( "cli#%d handshake timed out\n", c->fd );
+            if ( c->hello_len )
+            {
+                  COUNT( hello_timeouts, 1 );
+                  drop_client( c );
+            }
+            else
+                  set_role( c, false );
+            /* slot i now holds another pending client */
+      }
+}
+
+/* Takes up to MAX_ACCEPT new connections on listening socket `lfd` per
+ * wakeup (the rest on the next), leaving their handshakes to the event
+ * loop. Those on the packet socket are writers from the start. */
+static void accept_clients( int lfd )
+{
+      for ( int i = 0; i < MAX_ACCEPT; ++i )
+      {
+            int cfd = accept4( lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+            if ( cfd == -1 )
+            {
+                  if ( errno == EINTR )
+                        continue;
+                  if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                        perror( "accept" );
+                  return;
+            }
+            COUNT( accepts, 1 );
+            Client *c = add_client( cfd );
+            if ( !c )
+            {
+                  V( "srv: max clients (%zu) reached\n", max_clients );
+                  COUNT( refused, 1 );
+                  close( cfd );
+            }
+            else if ( lfd == pkt_fd )
+            {
+                  set_role( c, false ); /* no handshake there */
+                  c->packets = true;
+            }
+      }
+}
+
+/* `share`: how much a writer may be read this pass */
+static void client_ready( Client *c, uint32_t events, char *buf, size_t share )
+{
+      if ( c->hello )
+      {
+            pending_input( c );
+            return;
+      }
+      if ( c->packets )
+      {
+            if ( writer_quota( c, share ) || events & ( EPOLLHUP | EPOLLERR ) )
+                  packet_input( c );
+            else
+                  writer_hold( c );
+            return;
+      }
+      if ( c->ctl )
+      {
+            ctl_flush( c );
+            return;
+      }
+      if ( relay && !c->is_reader )
+      {
+            relay_input( c, share );
+            return;
+      }
+      if ( events & EPOLLOUT )
+      {
+            reader_flush( c );
+            if ( c->fd == -1 || !( events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) )
+                  return;
+      }
+
+      size_t want = c->is_reader ? BUF_SIZE : writer_quota( c, share );
+      if ( !want && !( events & ( EPOLLHUP | EPOLLERR ) ) )
+      {
+            writer_hold( c );
+            return;
+      }
+      ssize_t n = read( c->fd, buf, want ? want : share ); /* gone: drain */
+      if ( n <= 0 )
+      {
+            if ( n == -1 && errno == EAGAIN && !c->is_reader )
+                  COUNT( read_eagain, 1 );
+            if ( n == -1 && ( errno == EINTR || errno == EAGAIN ) )
+                  return;
+            if ( !c->is_reader )
+                  writer_eof( c );
+            drop_client( c ); /* EOF / error */
+      }
+      else if ( !c->is_reader )
+      { /* writer data */
+            V( "cli#%d → %zd bytes\n", c->fd, n );
+            if ( writer_admit( c, (size_t)n ) )
+                  writer_input( c, buf, (size_t)n );
+            else
+                  writer_discard( c, (size_t)n, count_lines( buf, (size_t)n ),
+                                  buf[ n - 1 ] != '\n' );
+      }
+}
+
+/* ───────────────────── reader threads (-t) ───────────────── */
+
+/* The main loop accepts, reads writers, fills the ring (and the log) and
+ * serves the readers that need its tables: subscribed ones, and those
+ * still catching up from the log. Every other reader is handed to the
+ * least loaded of num_workers threads, each with an epoll loop of its
+ * own, through a single-producer queue. After each fanout the main loop
+ * wakes the workers with readers, which send from the shared ring up to
+ * ring_pub. What they change of the shared state is the segment refs and
+ * the channels' reader and blocking counts, all atomic. */
+
+/* Passes the main loop's live, unsubscribed readers on to workers. */
+static void hand_off_readers( void )
+{
+      for ( size_t i = 0; i < num_readers; )
+      {
+            Client *c = readers[ i ];
+            if ( c->wants || c->disk_fd != -1 || c->shm )
+            {
+                  ++i; /* stays */
+                  continue;
+            }
+
+            Worker *w = &workers[ 0 ];
+            for ( int k = 1; k < num_workers; ++k )
+                  if ( atomic_load( &workers[ k ].load ) <
+                       atomic_load( &w->load ) )
+                        w = &workers[ k ];
+            size_t tail = atomic_load_explicit( &w->in_tail,
+                                                memory_order_relaxed );
+            if ( tail - atomic_load( &w->in_head ) == INBOX_SIZE )
+                  return; /* the rest wait for room */
+
+            epoll_ctl( ep_fd, EPOLL_CTL_DEL, c->fd, NULL );
+            list_remove( c ); /* slot i now holds another reader */
+            --num_readers;
+            c->w                          = w;
+            w->inbox[ tail % INBOX_SIZE ] = c;
+            atomic_fetch_add( &w->load, 1 );
+            atomic_store_explicit( &w->in_tail, tail + 1,
+                                   memory_order_release );
+            wake( w->wake_fd );
+      }
+}
+
+/* Takes in the readers the main loop handed over. Returns how many. */
+static size_t worker_adopt( Worker *w )
+{
+      size_t head = atomic_load_explicit( &w->in_head, memory_order_relaxed );
+      size_t tail = atomic_load_explicit( &w->in_tail, memory_order_acquire );
+      for ( size_t i = head; i != tail; ++i )
+      {
+            Client *c = w->inbox[ i % INBOX_SIZE ];
+            list_add( c, &w->readers, w->num_readers++, &w->readers_cap );
+
+            struct epoll_event ev = {
+                .events   = c->out_armed ? EPOLLIN | EPOLLOUT : EPOLLIN,
+                .data.ptr = c };
+            if ( epoll_ctl( w->ep_fd, EPOLL_CTL_ADD, c->fd, &ev ) == -1 )
+                  drop_client( c );
+            else
+                  V( "cli#%d ⇒ on worker %d\n", c->fd, w->id );
+      }
+      atomic_store_explicit( &w->in_head, tail, memory_order_release );
+      return tail - head;
+}
+
+static void *worker_main( void *arg )
+{
+      Worker *w     = arg;
+      unsigned long long seen = 0; /* fanout_gen last sent up to */
+      char buf[ BUF_SIZE ];
+      struct epoll_event evs[ MAX_EVENTS ];
+      for ( ;; )
+      {
+            int n = epoll_wait( w->ep_fd, evs, MAX_EVENTS, -1 );
+            if ( n < 0 )
+                  n = 0;
+            uint64_t t0 = now_us();
+            bool quit   = atomic_load( &w->quit ); /* after a last fanout */
+
+            for ( int i = 0; i < n; ++i )
+            {
+                  Client *c = evs[ i ].data.ptr;
+                  uint64_t v;
+                  if ( !c )
+                        read( w->wake_fd, &v, sizeof v );
+                  else if ( c->fd != -1 )
+                        client_ready( c, evs[ i ].events, buf, BUF_SIZE );
+            }
+
+            unsigned long long gen = atomic_load_explicit( &fanout_gen,
+                                                           memory_order_relaxed );
+            if ( worker_adopt( w ) || gen != seen )
+            {
+                  seen = gen;
+                  serve_readers( w->readers, &w->num_readers );
+            }
+            free_clients( w->dead, w->num_dead );
+            w->num_dead = 0;
+
+            if ( atomic_exchange( &w->dump, false ) )
+            {
+                  fprintf( stderr, "worker %d: %zu readers\n", w->id,
+                           w->num_readers );
+                  for ( size_t i = 0; i < w->num_readers; ++i )
+                        dump_reader( w->readers[ i ] );
+            }
+            hist_add( &w->loop_hist, now_us() - t0 );
+            if ( quit )
+                  return NULL;
+      }
+}
+
+/* Starts num_workers threads, with the signals left to the main one. */
+static void start_workers( void )
+{
+      if ( main_wake_fd == -1 ) /* else started again after a restart failed */
+      {
+            main_wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+            struct epoll_event ev = { .events   = EPOLLIN,
+                                      .data.ptr = &main_wake_fd };
+            if ( main_wake_fd == -1 ||
+                 epoll_ctl( ep_fd, EPOLL_CTL_ADD, main_wake_fd, &ev ) == -1 )
+                  die( "eventfd" );
+      }
+
+      workers = calloc( (size_t)num_workers, sizeof *workers );
+      if ( !workers )
+            die( "calloc" );
+      sigset_t all, old;
+      sigfillset( &all );
+      pthread_sigmask( SIG_BLOCK, &all, &old );
+      for ( int i = 0; i < num_workers; ++i )
+      {
+            Worker *w  = &workers[ i ];
+            w->id      = i;
+            w->ep_fd   = epoll_create1( EPOLL_CLOEXEC );
+            w->wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+            struct epoll_event wev = { .events = EPOLLIN, .data.ptr = NULL };
+            if ( w->ep_fd == -1 || w->wake_fd == -1 ||
+                 epoll_ctl( w->ep_fd, EPOLL_CTL_ADD, w->wake_fd, &wev ) == -1 )
+                  die( "worker" );
+            errno = pthread_create( &w->tid, NULL, worker_main, w );
+            if ( errno )
+                  die( "pthread_create" );
+      }
+      pthread_sigmask( SIG_SETMASK, &old, NULL );
+      V( "srv: %d reader threads\n", num_workers );
+}
+
+static void stop_workers( void )
+{
+      for ( int i = 0; i < num_workers; ++i )
+      {
+            atomic_store( &workers[ i ].quit, true );
+            wake( workers[ i ].wake_fd );
+      }
+      for ( int i = 0; i < num_workers; ++i )
+            pthread_join( workers[ i ].tid, NULL );
+}
+
+/* ─────────────────────── control socket (-C) ─────────────── */
+
+/* With -C a local scraper that connects to <path> is sent every counter
+ * in the Prometheus text format and hung up on. The totals are the
+ * always-on atomics in `stats`; per client lines cover the main loop's
+ * clients (a worker's readers are in the totals and in its SIGUSR1
+ * dump). Building the text happens on connect, sending it as the
+ * scraper's socket takes it, so a slow scraper holds nothing up. */
+
+static void hist_dump( FILE *f, const char *loop, Hist *h )
+{
+      unsigned long long n = 0;
+      for ( int i = 0; i < HIST_BUCKETS; ++i )
+      {
+            n += atomic_load_explicit( &h->le[ i ], memory_order_relaxed );
+            if ( i < HIST_BUCKETS - 1 )
+                  fprintf( f, "nntmd_loop_us_bucket{loop=\"%s\",le=\"%llu\"} %llu\n",
+                           loop, 1ull << i, n );
+            else
+                  fprintf( f, "nntmd_loop_us_bucket{loop=\"%s\",le=\"+Inf\"} %llu\n",
+                           loop, n );
+      }
+      fprintf( f, "nntmd_loop_us_sum{loop=\"%s\"} %llu\n", loop,
+               (unsigned long long)atomic_load( &h->sum_us ) );
+      fprintf( f, "nntmd_loop_us_count{loop=\"%s\"} %llu\n", loop, n );
+}
+
+static void ctl_dump( FILE *f )
+{
+      static const struct
+      {
+            const char *name;
+            atomic_ullong *v;
+      } totals[] = {
+            { "nntmd_accepts_total", &stats.accepts },
+            { "nntmd_rejects_total{reason=\"max_clients\"}", &stats.refused },
+            { "nntmd_rejects_total{reason=\"handshake_timeout\"}",
+              &stats.hello_timeouts },
+            { "nntmd_rejects_total{reason=\"handshake_too_long\"}",
+              &stats.hello_too_long },
+            { "nntmd_in_bytes_total", &stats.bytes_in },
+            { "nntmd_in_lines_total", &stats.lines_in },
+            { "nntmd_long_lines_total", &stats.long_lines },
+            { "nntmd_out_bytes_total", &stats.bytes_out },
+            { "nntmd_out_calls_total", &stats.writes },
+            { "nntmd_eagain_total{op=\"read\"}", &stats.read_eagain },
+            { "nntmd_eagain_total{op=\"write\"}", &stats.write_eagain },
+            { "nntmd_dropped_lines_total{reason=\"slow_reader\"}",
+              &stats.dropped_lines },
+            { "nntmd_gaps_total", &stats.gaps },
+            { "nntmd_disconnects_total{reason=\"slow_reader\"}",
+              &stats.slow_disconnects },
+            { "nntmd_blocks_total", &stats.blocks },
+            { "nntmd_writer_holds_total", &stats.holds },
+            { "nntmd_dropped_lines_total{reason=\"writer_rate\"}",
+              &stats.rate_dropped },
+            { "nntmd_verbose_held_total", &stats.verbose_held },
+      };
+      for ( size_t i = 0; i < sizeof totals / sizeof totals[ 0 ]; ++i )
+            fprintf( f, "%s %llu\n", totals[ i ].name,
+                     (unsigned long long)atomic_load_explicit(
+                         totals[ i ].v, memory_order_relaxed ) );
+
+      size_t segments = 0, paused = 0;
+      for ( size_t i = 0; i < num_channels; ++i )
+      {
+            segments += ring_segments( channels[ i ] );
+            paused += channels[ i ]->paused;
+      }
+      fprintf( f,
+               "nntmd_uptime_seconds %llu\n"
+               "nntmd_fanouts_total %llu\n"
+               "nntmd_clients{role=\"reader\"} %zu\n"
+               "nntmd_clients{role=\"writer\"} %zu\n"
+               "nntmd_clients{role=\"pending\"} %zu\n"
+               "nntmd_ring_bytes %zu\n"
+               "nntmd_writers_paused %zu\n",
+               (unsigned long long)( now_ms() - started_ms ) / 1000, fanouts,
+               total_readers(), num_writers, num_pending, segments * SEG_SIZE,
+               paused );
+
+      for ( size_t i = 0; i < num_channels; ++i )
+      {
+            Channel *ch   = channels[ i ];
+            const char *n = ch->name;
+            fprintf( f,
+                     "nntmd_channel_in_bytes_total{chan=\"%s\"} %llu\n"
+                     "nntmd_channel_in_lines_total{chan=\"%s\"} %llu\n"
+                     "nntmd_channel_dropped_lines_total{chan=\"%s\"} %llu\n"
+                     "nntmd_channel_clients{chan=\"%s\",role=\"reader\"} %zu\n"
+                     "nntmd_channel_clients{chan=\"%s\",role=\"writer\"} %zu\n"
+                     "nntmd_channel_ring_bytes{chan=\"%s\"} %zu\n",
+                     n, (unsigned long long)atomic_load( &ch->bytes_in ), n,
+                     (unsigned long long)atomic_load( &ch->lines_in ), n,
+                     (unsigned long long)atomic_load( &ch->dropped_lines ), n,
+                     atomic_load( &ch->readers ), n, ch->writers, n,
+                     ring_segments( ch ) * SEG_SIZE );
+      }
+
+      hist_dump( f, "main", &loop_hist );
+      for ( int i = 0; i < num_workers; ++i )
+      {
+            char name[ 24 ];
+            snprintf( name, sizeof name, "worker%d", i );
+            hist_dump( f, name, &workers[ i ].loop_hist );
+            fprintf( f, "nntmd_worker_readers{worker=\"%d\"} %zu\n", i,
+                     atomic_load( &workers[ i ].load ) );
+      }
+
+      for ( size_t i = 0; i < num_readers; ++i )
+      {
+            Client *c = readers[ i ];
+            fprintf( f,
+                     "nntmd_reader_out_bytes{cli=\"%d\"} %llu\n"
+                     "nntmd_reader_dropped_lines{cli=\"%d\"} %llu\n",
+                     c->fd, c->sent, c->fd, c->dropped_lines );
+            uint64_t lag =
+                c->shm ? main_ch.ring_end -
+                             atomic_load( &shm_hdr->slots[ c->shm_slot ].pos )
+                : relay            ? c->pipe_len
+                : c->disk_fd == -1 ? ring_published( c->ch ) - c->cursor
+                                   : 0; /* still on the log files */
+            fprintf( f, "nntmd_reader_lag_bytes{cli=\"%d\"} %llu\n", c->fd,
+                     (unsigned long long)lag );
+      }
+      for ( size_t i = 0; i < num_writers; ++i )
+      {
+            Client *c = writers[ i ];
+            fprintf( f,
+                     "nntmd_writer_in_bytes{cli=\"%d\"} %llu\n"
+                     "nntmd_writer_in_lines{cli=\"%d\"} %llu\n"
+                     "nntmd_writer_long_lines{cli=\"%d\"} %llu\n",
+                     c->fd, c->bytes_in, c->fd, c->lines_in, c->fd,
+                     c->long_lines );
+            if ( c->rate )
+                  fprintf( f,
+                           "nntmd_writer_rate_bytes{cli=\"%d\"} %zu\n"
+                           "nntmd_writer_held_ms{cli=\"%d\"} %llu\n"
+                           "nntmd_writer_rate_dropped_lines{cli=\"%d\"} %llu\n",
+                           c->fd, c->rate, c->fd,
+                           c->held_ms + ( c->held ? now_ms() - c->held_at : 0 ),
+                           c->fd, c->rate_dropped );
+      }
+}
+
+/* A scraper connected: its dump is taken now and sent as it can take it. */
+static void ctl_accept( void )
+{
+      for ( int i = 0; i < MAX_ACCEPT; ++i )
+      {
+            int fd = accept4( ctl_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+            if ( fd == -1 )
+            {
+                  if ( errno == EINTR )
+                        continue;
+                  return;
+            }
+            Client *c = calloc( 1, sizeof *c );
+            FILE *f   = c ? open_memstream( &c->pend, &c->pend_len ) : NULL;
+            if ( f )
+            {
+                  ctl_dump( f );
+                  fclose( f );
+            }
+            struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+            if ( !f || epoll_ctl( ep_fd, EPOLL_CTL_ADD, fd, &ev ) == -1 )
+            {
+                  close( fd );
+                  if ( c )
+                        free( c->pend );
+                  free( c );
+                  continue;
+            }
+            c->fd  = fd;
+            c->ctl = true;
+      }
+}
+
+/* EPOLLOUT on a control connection: sends more of its dump, and hangs up
+ * once all of it is out. */
+static void ctl_flush( Client *c )
+{
+      ssize_t w = write( c->fd, c->pend, c->pend_len );
+      if ( w == -1 && ( errno == EAGAIN || errno == EINTR ) )
+            return;
+      if ( w <= 0 || !( c->pend_len -= (size_t)w ) )
+      {
+            drop_client( c );
+            return;
+      }
+      memmove( c->pend, c->pend + w, c->pend_len );
+}
+
+/* ─────────────────────── restart (SIGUSR2) ───────────────── */
+
+/* On SIGUSR2 nntmd execs itself again (whatever binary argv[0] names now,
+ * with the same options) and hands the new process all it serves over a
+ * socketpair: the listening sockets, the shared ring's memfd, the bytes
+ * of every channel's ring and each client's socket with its role, place
+ * in the stream and buffered data, as Handoff messages with descriptors
+ * in SCM_RIGHTS. Nobody is disconnected and no line is lost: what writers
+ * sent meanwhile waits in their sockets, readers go on from their
+ * cursors. The old process exits once the new one answers, and carries
+ * on as it was if it does not. Counters start again from zero, and
+ * control socket scrapes in progress are cut short. */
+
+enum
+{
+      HO_HELLO,   /* pos: HANDOFF_MAGIC, seq: sizeof( Handoff ) */
+      HO_LISTEN,  /* the socket of -p (flags 0), -S (1) or -C (2) */
+      HO_SHM,     /* the memfd of -M */
+      HO_CHANNEL, /* payload: its name; pos: where its ring starts, seq: its
+                   * next_seq, flags: 1 if that is mid-line */
+      HO_RING,    /* payload: the next bytes of the last channel's ring */
+      HO_CLIENT,  /* see hand_client() */
+      HO_END
+};
+
+/* HO_CLIENT flags */
+#define HC_PENDING 1 /* payload: its handshake so far */
+#define HC_READER 2  /* payload: pend, then subs (len2 bytes) */
+#define HC_SUBS 4
+#define HC_MID_LINE 8
+#define HC_SHM 16  /* and its eventfd */
+#define HC_DISK 32 /* and its log file, at disk_seq and off */
+#define HC_PIPE 64 /* and its pipe, holding off bytes */
+#define HC_PACKETS 128 /* writer, payload: its unfinished line */
+#define HC_SKIPPING 256
+
+typedef struct
+{
+      uint32_t kind;
+      uint32_t nfds; /* sent along with it */
+      uint32_t flags;
+      uint32_t chan; /* index in channels[] */
+      int32_t slot;  /* shared ring slot */
+      uint32_t pad;
+      uint64_t pos;  /* reader cursor */
+      uint64_t seq;
+      uint64_t off;
+      uint64_t rate; /* writer's own -r */
+      uint64_t len;  /* payload bytes after it */
+      uint64_t len2;
+} Handoff;
+
+/* Sends h with fds and the payload p (n bytes) plus p2 (n2). */
+static bool handoff_send( int sock, Handoff *h, const int *fds, const char *p,
+                          size_t n, const char *p2, size_t n2 )
+{
+      h->len  = n + n2;
+      h->len2 = n2;
+      union
+      {
+            struct cmsghdr h;
+            char buf[ CMSG_SPACE( sizeof( int ) * HANDOFF_FDS ) ];
+      } u;
+      struct iovec iov[ 3 ] = {
+          { h, sizeof *h }, { (void *)p, n }, { (void *)p2, n2 } };
+      struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 3 };
+      if ( h->nfds )
+      {
+            msg.msg_control    = u.buf;
+            msg.msg_controllen = CMSG_SPACE( sizeof( int ) * h->nfds );
+            struct cmsghdr *cm = CMSG_FIRSTHDR( &msg );
+            cm->cmsg_level     = SOL_SOCKET;
+            cm->cmsg_type      = SCM_RIGHTS;
+            cm->cmsg_len       = CMSG_LEN( sizeof( int ) * h->nfds );
+            memcpy( CMSG_DATA( cm ), fds, sizeof( int ) * h->nfds );
+      }
+
+      size_t left = sizeof *h + n + n2;
+      ssize_t w;
+      while ( ( w = sendmsg( sock, &msg, MSG_NOSIGNAL ) ) == -1 &&
+              errno == EINTR )
+            ;
+      for ( int i = 0;; ) /* the rest of a short send */
+      {
+            if ( w == -1 && errno == EINTR )
+                  w = 0;
+            else if ( w <= 0 )
+                  return false;
+            left -= (size_t)w;
+            if ( !left )
+                  return true;
+            while ( (size_t)w >= iov[ i ].iov_len )
+                  w -= (ssize_t)iov[ i++ ].iov_len;
+            iov[ i ].iov_base = (char *)iov[ i ].iov_base + w;
+            iov[ i ].iov_len -= (size_t)w;
+            w = writev( sock, iov + i, 3 - i );
+      }
+}
+
+static bool read_full( int sock, void *p, size_t n )
+{
+      while ( n )
+      {
+            ssize_t r = recv( sock, p, n, MSG_WAITALL );
+            if ( r == -1 && errno == EINTR )
+                  continue;
+            if ( r <= 0 )
+                  return false;
+            p = (char *)p + r;
+            n -= (size_t)r;
+      }
+      return true;
+}
+
+/* The next message into h and fds, its payload (NUL terminated) into
+ * *buf. */
+static bool handoff_recv( int sock, Handoff *h, int *fds, char **buf,
+                          size_t *cap )
+{
+      union
+      {
+            struct cmsghdr h;
+            char buf[ CMSG_SPACE( sizeof( int ) * HANDOFF_FDS ) ];
+      } u;
+      struct iovec iov  = { h, sizeof *h };
+      struct msghdr msg = { .msg_iov        = &iov,
+                            .msg_iovlen     = 1,
+                            .msg_control    = u.buf,
+                            .msg_controllen = sizeof u.buf };
+      ssize_t r;
+      while ( ( r = recvmsg( sock, &msg, MSG_CMSG_CLOEXEC ) ) == -1 &&
+              errno == EINTR )
+            ;
+      if ( r <= 0 || ( msg.msg_flags & MSG_CTRUNC ) ||
+           !read_full( sock, (char *)h + r, sizeof *h - (size_t)r ) )
+            return false;
+
+      struct cmsghdr *cm = CMSG_FIRSTHDR( &msg );
+      size_t nfds        = cm && cm->cmsg_type == SCM_RIGHTS
+                               ? ( cm->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int )
+                               : 0;
+      if ( nfds != h->nfds )
+            return false;
+      memcpy( fds, CMSG_DATA( cm ), sizeof( int ) * nfds );
+      *buf = grow( *buf, cap, h->len + 1, 1 );
+      ( *buf )[ h->len ] = '\0';
+      return read_full( sock, *buf, h->len );
+}
+
+static bool hand_client( int sock, Client *c )
+{
+      Handoff h    = { .kind = HO_CLIENT, .nfds = 1 };
+      int fds[ HANDOFF_FDS ] = { c->fd };
+      if ( c->hello )
+      {
+            h.flags = HC_PENDING;
+            return handoff_send( sock, &h, fds, c->hello, c->hello_len, NULL,
+                                 0 );
+      }
+      while ( channels[ h.chan ] != c->ch )
+            ++h.chan;
+      if ( !c->is_reader )
+      {
+            h.flags = ( c->packets ? HC_PACKETS : 0 ) |
+                      ( c->skipping ? HC_SKIPPING : 0 );
+            h.rate  = c->rate;
+            return handoff_send( sock, &h, fds, c->part, c->part_len, NULL,
+                                 0 );
+      }
+
+      h.flags = HC_READER | ( c->subs ? HC_SUBS : 0 ) |
+                ( c->mid_line ? HC_MID_LINE : 0 );
+      h.pos   = c->cursor;
+      if ( c->shm )
+      {
+            h.flags |= HC_SHM;
+            h.slot              = c->shm_slot;
+            fds[ h.nfds++ ]     = c->shm_efd;
+      }
+      if ( c->disk_fd != -1 )
+      {
+            h.flags |= HC_DISK;
+            h.seq           = c->disk_seq;
+            h.off           = (uint64_t)c->disk_off;
+            fds[ h.nfds++ ] = c->disk_fd;
+      }
+      if ( c->pipe_fd[ 0 ] != -1 )
+      {
+            h.flags |= HC_PIPE;
+            h.off           = c->pipe_len;
+            fds[ h.nfds++ ] = c->pipe_fd[ 0 ];
+            fds[ h.nfds++ ] = c->pipe_fd[ 1 ];
+      }
+      return handoff_send( sock, &h, fds, c->pend, c->pend_len, c->subs,
+                           c->subs ? strlen( c->subs ) : 0 );
+}
+
+/* Everything the new process needs, in order. */
+static bool hand_state( int sock )
+{
+      Handoff h = { .kind = HO_HELLO, .pos = HANDOFF_MAGIC, .seq = sizeof h };
+      bool ok   = handoff_send( sock, &h, NULL, NULL, 0, NULL, 0 );
+
+      int lfds[ 3 ] = { srv_fd, pkt_fd, ctl_fd };
+      for ( uint32_t i = 0; ok && i < 3; ++i )
+            if ( lfds[ i ] != -1 )
+            {
+                  h  = ( Handoff ){ .kind = HO_LISTEN, .nfds = 1, .flags = i };
+                  ok = handoff_send( sock, &h, &lfds[ i ], NULL, 0, NULL, 0 );
+            }
+      if ( ok && shm_hdr )
+      {
+            h  = ( Handoff ){ .kind = HO_SHM, .nfds = 1 };
+            ok = handoff_send( sock, &h, &shm_fd, NULL, 0, NULL, 0 );
+      }
+
+      for ( size_t i = 0; ok && i < num_channels; ++i )
+      {
+            Channel *ch    = channels[ i ];
+            uint64_t start = ch->ring_head ? ch->ring_head->start : ch->ring_end;
+            bool mid       = start == ch->ring_end
+                                 ? ch->ring_mid
+                                 : !ch->num_recs || rec_at( ch, 0 )->off != start;
+            h  = ( Handoff ){ .kind  = HO_CHANNEL,
+                              .flags = mid,
+                              .pos   = start,
+                              .seq   = ch->next_seq };
+            ok = handoff_send( sock, &h, NULL, ch->name, strlen( ch->name ),
+                               NULL, 0 );
+            for ( Segment *s = ch->ring_head; ok && s; s = s->next )
+            {
+                  h  = ( Handoff ){ .kind = HO_RING };
+                  ok = handoff_send( sock, &h, NULL, s->data, s->len, NULL, 0 );
+            }
+      }
+
+      for ( size_t i = 0; ok && i < num_pending; ++i )
+            ok = hand_client( sock, pending[ i ] );
+      for ( size_t i = 0; ok && i < num_writers; ++i )
+            ok = hand_client( sock, writers[ i ] );
+      for ( size_t i = 0; ok && i < num_readers; ++i )
+            ok = hand_client( sock, readers[ i ] );
+      h = ( Handoff ){ .kind = HO_END };
+      return ok && handoff_send( sock, &h, NULL, NULL, 0, NULL, 0 );
+}
+
+/* Takes the stopped workers' readers back into the main loop. */
+static void reclaim_readers( void )
+{
+      for ( int i = 0; i < num_workers; ++i )
+      {
+            Worker *w = &workers[ i ];
+            for ( size_t k = 0; k < w->num_readers; ++k )
+            {
+                  Client *c = w->readers[ k ];
+                  c->w      = NULL;
+                  list_add( c, &readers, num_readers++, &readers_cap );
+                  struct epoll_event ev = {
+                      .events   = c->out_armed ? EPOLLIN | EPOLLOUT : EPOLLIN,
+                      .data.ptr = c };
+                  epoll_ctl( ep_fd, EPOLL_CTL_ADD, c->fd, &ev );
+            }
+            close( w->ep_fd );
+            close( w->wake_fd );
+            free( w->readers );
+            free( w->dead );
+      }
+      free( workers );
+      workers     = NULL;
+      num_workers = 0;
+}
+
+/* SIGUSR2: execs the new process and hands it over; returns only if that
+ * failed. */
+static void hand_over( void )
+{
+      V( "srv: restarting as %s\n", self_argv[ 0 ] );
+      fanout(); /* the stages and the relay pipe are empty from here on */
+      if ( log_dir )
+            log_sync();
+      int threads = num_workers;
+      stop_workers();
+      reclaim_readers();
+
+      int sv[ 2 ] = { -1, -1 };
+      pid_t pid   = -1;
+      char ack    = 0;
+      if ( socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv ) == 0 )
+      {
+            struct timeval tv = { HANDOFF_MS / 1000, 0 };
+            setsockopt( sv[ 0 ], SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv );
+            setsockopt( sv[ 0 ], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv );
+            pid = fork();
+      }
+      if ( pid == 0 )
+      {
+            char env[ 16 ];
+            snprintf( env, sizeof env, "%d", sv[ 1 ] );
+            setenv( HANDOFF_ENV, env, 1 );
+            fcntl( sv[ 1 ], F_SETFD, 0 );
+            execvp( self_argv[ 0 ], self_argv );
+            perror( self_argv[ 0 ] );
+            _exit( 127 );
+      }
+      if ( sv[ 1 ] != -1 )
+            close( sv[ 1 ] );
+      if ( pid > 0 && hand_state( sv[ 0 ] ) &&
+           read_full( sv[ 0 ], &ack, 1 ) && ack == 'K' )
+      {
+            V( "srv: handed over to pid %d\n", (int)pid );
+            keep_socket_files = true;
+            exit( 0 );
+      }
+
+      fprintf( stderr, "nntmd: restart failed, still serving\n" );
+      if ( pid > 0 )
+      {
+            kill( pid, SIGKILL );
+            waitpid( pid, NULL, 0 );
+      }
+      if ( sv[ 0 ] != -1 )
+            close( sv[ 0 ] );
+      num_workers = threads;
+      if ( num_workers )
+            start_workers(); /* the readers go back to them by and by */
+}
+
+/* A client handed over: registered again as it was. */
+static void adopt_client( const Handoff *h, const char *p, const int *fds )
+{
+      Client *c = add_client( fds[ 0 ] );
+      if ( !c || ( !( h->flags & HC_PENDING ) && h->chan >= num_channels ) )
+      {
+            for ( uint32_t i = c ? 1 : 0; i < h->nfds; ++i )
+                  close( fds[ i ] );
+            if ( c )
+                  drop_client( c );
+            return;
+      }
+      if ( h->flags & HC_PENDING )
+      {
+            c->hello_len = h->len < HELLO_MAX ? h->len : HELLO_MAX;
+            memcpy( c->hello, p, c->hello_len );
+            return;
+      }
+
+      int k = 1;
+      c->ch = channels[ h->chan ];
+      if ( !( h->flags & HC_READER ) )
+      {
+            set_role( c, false );
+            c->packets  = h->flags & HC_PACKETS;
+            c->skipping = h->flags & HC_SKIPPING;
+            if ( h->rate && h->rate != c->rate )
+                  bucket_set( c, h->rate );
+            c->part     = grow( c->part, &c->part_cap, h->len, 1 );
+            c->part_len = h->len;
+            memcpy( c->part, p, h->len );
+            return;
+      }
+
+      if ( h->flags & HC_SHM )
+      {
+            c->shm      = true;
+            c->shm_slot = h->slot & ( SHM_SLOTS - 1 );
+            c->shm_efd  = fds[ k++ ];
+            shm_used[ c->shm_slot / 64 ] |= 1ull << ( c->shm_slot % 64 );
+      }
+      set_role( c, true );
+      c->mid_line = h->flags & HC_MID_LINE;
+      if ( h->flags & HC_SUBS )
+            reader_subscribe( c, p + h->len - h->len2 );
+      if ( h->len > h->len2 )
+            pend_append( c, p, h->len - h->len2 );
+
+      if ( c->shm || h->flags & HC_DISK )
+      {
+            --c->seg->refs; /* holds no place in the broadcast ring */
+            c->seg = NULL;
+      }
+      else if ( c->ch->ring_head && h->pos >= c->ch->ring_head->start &&
+                h->pos < c->cursor )
+            reader_rewind( c, h->pos );
+      if ( h->flags & HC_DISK )
+      {
+            c->disk_fd  = fds[ k++ ];
+            c->disk_seq = h->seq;
+            c->disk_off = (off_t)h->off;
+      }
+      if ( h->flags & HC_PIPE )
+      {
+            c->pipe_fd[ 0 ] = fds[ k++ ];
+            c->pipe_fd[ 1 ] = fds[ k++ ];
+            c->pipe_len     = h->off;
+      }
+      if ( c->disk_fd != -1 || c->pipe_len )
+      {
+            c->out_armed = true;
+            set_events( c, EPOLLIN | EPOLLOUT );
+      }
+}
+
+/* The new process of a restart: takes over what the old one hands it on
+ * `sock`, except its answer, sent once the rest is set up. Exits if that
+ * fails, and the old process goes on serving. */
+static void take_over( int sock )
+{
+      struct timeval tv = { HANDOFF_MS / 1000, 0 };
+      setsockopt( sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv );
+
+      Handoff h;
+      int fds[ HANDOFF_FDS ];
+      char *buf   = NULL;
+      size_t cap  = 0;
+      Channel *ch = &main_ch;
+      size_t took = 0;
+      if ( !handoff_recv( sock, &h, fds, &buf, &cap ) || h.kind != HO_HELLO ||
+           h.pos != HANDOFF_MAGIC || h.seq != sizeof h )
+      {
+            fprintf( stderr, "nntmd: not handed over by this version\n" );
+            exit( 1 );
+      }
+
+      taking_over = true;
+      while ( handoff_recv( sock, &h, fds, &buf, &cap ) && h.kind != HO_END )
+            if ( h.kind == HO_LISTEN && h.nfds == 1 )
+                  *( h.flags == 0   ? &srv_fd
+                     : h.flags == 1 ? &pkt_fd
+                                    : &ctl_fd ) = fds[ 0 ];
+            else if ( h.kind == HO_SHM && h.nfds == 1 )
+            {
+                  if ( shm_size )
+                        shm_open_ring( fds[ 0 ] );
+                  else
+                        close( fds[ 0 ] );
+            }
+            else if ( h.kind == HO_CHANNEL )
+            {
+                  ch = *buf ? channel_get( buf ) : &main_ch;
+                  if ( !ch )
+                        break;
+                  ch->ring_end = h.pos;
+                  ch->ring_mid = h.flags & 1;
+                  if ( h.seq > ch->next_seq )
+                        ch->next_seq = h.seq;
+                  atomic_store( &ch->ring_pub, ch->ring_end );
+            }
+            else if ( h.kind == HO_RING )
+                  ring_append( ch, buf, h.len );
+            else if ( h.kind == HO_CLIENT && h.nfds >= 1 )
+            {
+                  adopt_client( &h, buf, fds );
+                  ++took;
+            }
+      taking_over = false;
+      free( buf );
+      if ( h.kind != HO_END )
+      {
+            fprintf( stderr, "nntmd: restart cut short\n" );
+            exit( 1 );
+      }
+      for ( size_t i = 0; i < num_channels; ++i )
+            ring_trim( channels[ i ] );
+      fanout_due = true; /* whatever readers were behind on */
+      fanout_at  = 0;
+      V( "srv: took over %zu clients\n", took );
+}
+
+/* ─────────────────────────── main ────────────────────────── */
+
+static int listen_on( const char *path, int type )
+{
+      unlink( path );
+      int fd = socket( AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+      if ( fd == -1 )
+            die( "socket" );
+
+      struct sockaddr_un sa = { .sun_family = AF_UNIX };
+      strncpy( sa.sun_path, path, sizeof( sa.sun_path ) - 1 );
+      if ( bind( fd, (struct sockaddr *)&sa, sizeof( sa ) ) )
+            die( "bind" );
+      if ( listen( fd, listen_backlog ) )
+            die( "listen" );
+      return fd;
+}
+
+int main( int argc, char **argv )
+{
+      for ( int i = 1; i < argc; ++i )
+            if ( !strcmp( argv[ i ], "-v" ) ||
+                 !strcmp( argv[ i ], "--verbose" ) )
+                  verbose = true;
+            else if ( !strcmp( argv[ i ], "-p" ) && i + 1 < argc )
+                  sock_path = argv[ ++i ];
+            else if ( !strcmp( argv[ i ], "-S" ) && i + 1 < argc )
+                  pkt_path = argv[ ++i ];
+            else if ( !strcmp( argv[ i ], "-m" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) > 0 )
+                  max_clients = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-q" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) >= BUF_SIZE )
+                  queue_limit = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-b" ) && i + 1 < argc )
+                  backlog_lines = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-B" ) && i + 1 < argc )
+                  backlog_bytes = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-L" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) >= 2 )
+                  line_limit = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-o" ) && i + 1 < argc &&
+                      ( !strcmp( argv[ i + 1 ], "drop" ) ||
+                        !strcmp( argv[ i + 1 ], "disconnect" ) ||
+                        !strcmp( argv[ i + 1 ], "block" ) ) )
+            {
+                  ++i;
+                  overflow = !strcmp( argv[ i ], "drop" )         ? OVF_DROP
+                             : !strcmp( argv[ i ], "disconnect" ) ? OVF_DISCONNECT
+                                                                  : OVF_BLOCK;
+            }
+            else if ( !strcmp( argv[ i ], "-c" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) >= 0 )
+                  coalesce_ms = atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-d" ) && i + 1 < argc )
+                  log_dir = argv[ ++i ];
+            else if ( !strcmp( argv[ i ], "-D" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) >= BUF_SIZE )
+                  log_seg_bytes = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-R" ) && i + 1 < argc )
+                  log_max_bytes = atoll( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-A" ) && i + 1 < argc )
+                  log_max_age = atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-F" ) && i + 1 < argc )
+                  log_fsync_ms = atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-H" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) >= 0 )
+                  hello_ms = atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-l" ) && i + 1 < argc &&
+                      atoi( argv[ i + 1 ] ) > 0 )
+                  listen_backlog = atoi( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-t" ) && i + 1 < argc &&
+                      atoi( argv[ i + 1 ] ) >= 0 &&
+                      atoi( argv[ i + 1 ] ) <= MAX_WORKERS )
+                  num_workers = atoi( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-M" ) && i + 1 < argc )
+                  shm_size = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-T" ) )
+                  stamp_time = true;
+            else if ( !strcmp( argv[ i ], "-Z" ) )
+                  relay = true;
+            else if ( !strcmp( argv[ i ], "-C" ) && i + 1 < argc )
+                  ctl_path = argv[ ++i ];
+            else if ( !strcmp( argv[ i ], "-r" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) >= 0 )
+                  writer_rate = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-k" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) >= 0 )
+                  writer_burst = (size_t)atol( argv[ ++i ] );
+            else if ( !strcmp( argv[ i ], "-O" ) && i + 1 < argc &&
+                      ( !strcmp( argv[ i + 1 ], "pause" ) ||
+                        !strcmp( argv[ i + 1 ], "drop" ) ) )
+                  rate_drop = !strcmp( argv[ ++i ], "drop" );
+            else if ( !strcmp( argv[ i ], "-V" ) && i + 1 < argc &&
+                      atol( argv[ i + 1 ] ) >= 0 )
+                  verbose_rate = (unsigned)atol( argv[ ++i ] );
+            else
+            {
+                  fprintf( stderr,
+                           "usage: %s [-v] [-V <msgs-per-s>] [-p <sock>] "
+                           "[-S <packet-sock>] [-C <control-sock>] "
+                           "[-m <max-clients>] "
+                           "[-l <listen-backlog>] [-H <handshake-ms>] "
+                           "[-q <queue-bytes>] [-o drop|disconnect|block] "
+                           "[-L <line-limit>] [-c <coalesce-ms>] [-t <threads>] "
+                           "[-r <writer-bytes-per-s> [-k <burst-bytes>] "
+                           "[-O pause|drop]] "
+                           "[-M <shm-bytes>] [-Z] [-T] "
+                           "[-b <backlog-lines>] "
+                           "[-B <backlog-bytes>] [-d <log-dir> [-D <file-bytes>] "
+                           "[-R <max-bytes>] [-A <max-age-s>] [-F <fsync-ms>]]\n",
+                           argv[ 0 ] );
+                  return 1;
+            }
+
+      struct sigaction sa_sig = { .sa_handler = on_signal };
+      sigaction( SIGINT, &sa_sig, NULL );
+      sigaction( SIGTERM, &sa_sig, NULL );
+      sigaction( SIGUSR1, &sa_sig, NULL );
+      sigaction( SIGUSR2, &sa_sig, NULL );
+      signal( SIGPIPE, SIG_IGN ); /* a vanished reader is an EPIPE */
+      atexit( cleanup );
+      raise_fd_limit();
+      self_argv = argv;
+
+      /* started by a restart: the old process still serves until
+       * take_over() is done */
+      const char *handoff = getenv( HANDOFF_ENV );
+      int handoff_fd      = handoff ? atoi( handoff ) : -1;
+      if ( handoff )
+      {
+            unsetenv( HANDOFF_ENV );
+            fcntl( handoff_fd, F_SETFD, FD_CLOEXEC );
+            keep_socket_files = true;
+      }
+      if ( log_dir )
+            log_recover();
+      type_id( "all", 3 ); /* TYPE_ALL */
+      if ( shm_size && handoff_fd == -1 )
+            shm_open_ring( -1 );
+      numbered = log_dir || stamp_time;
+      if ( relay && ( numbered || shm_size || pkt_path || num_workers ) )
+      {
+            /* each of them needs whole lines in the ring */
+            fprintf( stderr, "nntmd: -Z ignored with -d, -T, -M, -S or -t\n" );
+            relay = false;
+      }
+      if ( relay && writer_rate )
+      {
+            /* a summary line or a dropped line would land mid-line */
+            fprintf( stderr, "nntmd: -r ignored with -Z\n" );
+            writer_rate = 0;
+      }
+      if ( relay )
+            relay_open();
+
+      ep_fd = epoll_create1( EPOLL_CLOEXEC );
+      if ( ep_fd == -1 )
+            die( "epoll_create1" );
+      if ( num_workers )
+            start_workers();
+      if ( handoff_fd != -1 )
+            take_over( handoff_fd );
+      if ( shm_size && !shm_hdr )
+            shm_open_ring( -1 );
+
+      if ( srv_fd == -1 )
+            srv_fd = listen_on( sock_path, SOCK_STREAM );
+      if ( pkt_path && pkt_fd == -1 )
+            pkt_fd = listen_on( pkt_path, SOCK_SEQPACKET );
+      if ( ctl_path && ctl_fd == -1 )
+            ctl_fd = listen_on( ctl_path, SOCK_STREAM );
+      started_ms = now_ms();
+      struct epoll_event sev = { .events = EPOLLIN, .data.ptr = NULL };
+      struct epoll_event pev = { .events = EPOLLIN, .data.ptr = &pkt_fd };
+      struct epoll_event cev = { .events = EPOLLIN, .data.ptr = &ctl_fd };
+      if ( epoll_ctl( ep_fd, EPOLL_CTL_ADD, srv_fd, &sev ) == -1 ||
+           ( pkt_fd != -1 &&
+             epoll_ctl( ep_fd, EPOLL_CTL_ADD, pkt_fd, &pev ) == -1 ) ||
+           ( ctl_fd != -1 &&
+             epoll_ctl( ep_fd, EPOLL_CTL_ADD, ctl_fd, &cev ) == -1 ) )
+            die( "epoll_ctl" );
+      if ( handoff_fd != -1 )
+      {
+            /* the old process exits once it reads this */
+            if ( write( handoff_fd, "K", 1 ) != 1 )
+                  die( "restart" );
+            close( handoff_fd );
+            keep_socket_files = false;
+      }
+
+      V( "srv: listening on %s (max %zu clients)\n", sock_path, max_clients );
+      if ( pkt_path )
+            V( "srv: taking a line per message on %s\n", pkt_path );
+      if ( shm_hdr )
+            V( "srv: shared memory ring of %zu KiB\n", shm_size / 1024 );
+      if ( writer_rate )
+            V( "srv: writers limited to %zu B/s (%s over it)\n", writer_rate,
+               rate_drop ? "dropping" : "pausing" );
+      if ( relay )
+            V( "srv: relaying bytes as they come (%zu KiB pipe)\n",
+               relay_cap / 1024 );
+
+      char buf[ BUF_SIZE ];
+      struct epoll_event evs[ MAX_EVENTS ];
+      while ( !stop )
+      {
+            /* wake up in time for the next fanout, group commit and
+             * handshake timeout */
+            uint64_t now = now_ms();
+            int timeout  = -1;
+            if ( fanout_due )
+                  timeout = wait_until( timeout, fanout_at, now );
+            if ( log_dirty )
+                  timeout = wait_until( timeout,
+                                        log_synced + (uint64_t)log_fsync_ms, now );
+            if ( num_pending && pending_due != UINT64_MAX )
+                  timeout = wait_until( timeout, pending_due, now );
+            if ( num_held )
+                  timeout = wait_until( timeout, held_due, now );
+
+            int n = epoll_wait( ep_fd, evs, MAX_EVENTS, timeout );
+            if ( n < 0 )
+            {
+                  if ( errno != EINTR )
+                        die( "epoll_wait" );
+                  n = 0; /* a signal: see below */
+            }
+            uint64_t t0 = now_us();
+
+            /* round robin: every writer with input gets an equal share
+             * of the pass, the rest waits for the next one */
+            size_t busy = 0;
+            for ( int i = 0; i < n; ++i )
+            {
+                  Client *c = evs[ i ].data.ptr;
+                  if ( c && (void *)c != &pkt_fd && (void *)c != &ctl_fd &&
+                       (void *)c != &main_wake_fd && c->fd != -1 &&
+                       !c->hello && !c->is_reader && !c->ctl )
+                        ++busy;
+            }
+            size_t share = busy ? ROUND_BYTES / busy : BUF_SIZE;
+            share        = share > BUF_SIZE    ? BUF_SIZE
+                           : share < MIN_SHARE ? MIN_SHARE
+                                               : share;
+
+            for ( int i = 0; i < n; ++i )
+            {
+                  Client *c = evs[ i ].data.ptr;
+                  uint64_t v;
+                  if ( !c )
+                        accept_clients( srv_fd ); /* ─── new connections ─── */
+                  else if ( (void *)c == &pkt_fd )
+                        accept_clients( pkt_fd );
+                  else if ( (void *)c == &ctl_fd )
+                        ctl_accept();
+                  else if ( (void *)c == &main_wake_fd )
+                  {
+                        read( main_wake_fd, &v, sizeof v );
+                        sync_writers(); /* a worker's reader (un)blocked */
+                  }
+                  else if ( c->fd != -1 )
+                        client_ready( c, evs[ i ].events, buf, share );
+            }
+            if ( num_pending && now_ms() >= pending_due )
+                  expire_pending( now_ms() );
+            if ( num_held && now_ms() >= held_due )
+                  release_writers( now_ms() );
+            if ( num_workers )
+                  hand_off_readers();
+            if ( fanout_due && now_ms() >= fanout_at )
+                  fanout();
+            reap_clients();
+
+            if ( log_dirty && now_ms() - log_synced >= (uint64_t)log_fsync_ms )
+            {
+                  log_sync();
+                  log_retain();
+            }
+
+            if ( dump )
+            {
+                  dump = 0;
+                  dump_counters();
+            }
+            if ( restart )
+            {
+                  restart = 0;
+                  hand_over();
+            }
+            hist_add( &loop_hist, now_us() - t0 );
+      }
+
+      if ( fanout_due )
+            fanout();
+      stop_workers();
+      if ( log_dir )
+            log_sync();
+      V( "srv: shutting down\n" );
+      return 0;
 }
@@ -0,0 +1,177 @@
+/* test_nntm_send – spool replays against daemons that hang up
+ *
+ *   test_nntm_send
+ *
+ * Fills a spool with numbered lines and opens a sender on it three times,
+ * against a stand-in daemon that says OK and then
+ *   - reads nothing and hangs up a little later: the spool must be left
+ *     as it was;
+ *   - reads 128 KiB and, likewise, hangs up: the spool must be left
+ *     holding the lines from a line boundary on, further in than nothing
+ *     but no further than what was read, and those before it counted as
+ *     sent;
+ *   - reads everything: the spool must end up empty, and the daemon must
+ *     have had exactly what it held.
+ * close() must come back in good time each time rather than copy the
+ * spool onto itself without end. Exits 0 when all of that holds.
+ */
+#define _GNU_SOURCE
+#include "../src/nntm_send.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SPOOL_LINES 100000 /* "line 0000000\n": 1.3 MB */
+#define LINE_LEN 13
+#define SPOOL_LEN ( SPOOL_LINES * LINE_LEN )
+#define TAKE_BYTES ( 128 * 1024 )
+#define TIME_LIMIT_S 20
+#define CLOSE_MS 5000
+#define LINGER_US 200000 /* for the sender to see what was read */
+
+static char sock_path[ 108 ], spool_path[ 108 ];
+static char spool[ SPOOL_LEN + 1 ];
+static char got[ 2 * SPOOL_LEN ]; /* what the daemon read */
+static int listen_fd;
+static size_t take;  /* bytes the daemon reads before it hangs up */
+static size_t taken; /* bytes it read */
+
+static void fail( const char *msg )
+{
+      fprintf( stderr, "test_nntm_send: %s\n", msg );
+      unlink( sock_path );
+      unlink( spool_path );
+      exit( 1 );
+}
+
+static void on_alarm( int sig )
+{
+      (void)sig;
+      unlink( spool_path ); /* it may be growing */
+      _exit( 1 );
+}
+
+/* One writer: reads its handshake, says OK, reads `take` bytes (or up to
+ * EOF) and, a little later, closes with the rest unread; the socket goes
+ * with it, so no reconnect. */
+static void *daemon_main( void *arg )
+{
+      (void)arg;
+      int fd = accept( listen_fd, NULL, NULL );
+      close( listen_fd );
+      unlink( sock_path );
+      if ( fd == -1 )
+            return NULL;
+
+      char c;
+      while ( read( fd, &c, 1 ) == 1 && c != '\n' )
+            ;
+      if ( write( fd, "OK\n", 3 ) != 3 )
+            fail( "OK" );
+      taken = 0;
+      while ( taken < take && taken < sizeof got )
+      {
+            size_t want = take - taken;
+            if ( want > sizeof got - taken )
+                  want = sizeof got - taken;
+            ssize_t n = read( fd, got + taken, want );
+            if ( n <= 0 )
+                  break;
+            taken += (size_t)n;
+      }
+      if ( take != SIZE_MAX )
+            usleep( LINGER_US );
+      close( fd );
+      return NULL;
+}
+
+/* Runs a sender on the spool against a daemon that reads `bytes`; returns
+ * how much the spool still holds, left in `left`. */
+static size_t run( size_t bytes, char *left, NntmSendStats *st )
+{
+      listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+      struct sockaddr_un sa = { .sun_family = AF_UNIX };
+      snprintf( sa.sun_path, sizeof sa.sun_path, "%s", sock_path );
+      if ( bind( listen_fd, (struct sockaddr *)&sa, sizeof sa ) == -1 ||
+           listen( listen_fd, 1 ) == -1 )
+            fail( "listen" );
+      take = bytes;
+      pthread_t th;
+      pthread_create( &th, NULL, daemon_main, NULL );
+
+      NntmSendOptions opt = { .sock_path = sock_path, .spool_path = spool_path };
+      NntmSend *s         = nntm_send_open( &opt );
+      if ( !s )
+            fail( "nntm_send_open" );
+      if ( bytes == SIZE_MAX )
+            nntm_send_close( s, CLOSE_MS, st ); /* the daemon reads to EOF */
+      pthread_join( th, NULL );
+      if ( bytes != SIZE_MAX )
+            nntm_send_close( s, CLOSE_MS, st );
+
+      int fd    = open( spool_path, O_RDONLY );
+      ssize_t n = fd == -1 ? -1 : read( fd, left, SPOOL_LEN + 1 );
+      close( fd );
+      if ( n < 0 || n > SPOOL_LEN )
+            fail( "spool grew" );
+      return (size_t)n;
+}
+
+int main( void )
+{
+      snprintf( sock_path, sizeof sock_path, "/tmp/test_nntm_send.%d.sock",
+                (int)getpid() );
+      snprintf( spool_path, sizeof spool_path, "/tmp/test_nntm_send.%d.spool",
+                (int)getpid() );
+      signal( SIGALRM, on_alarm ); /* a replay that never ends fails */
+      alarm( TIME_LIMIT_S );
+
+      for ( int i = 0; i < SPOOL_LINES; ++i )
+            sprintf( spool + i * LINE_LEN, "line %07d\n", i );
+      int fd = open( spool_path, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+      if ( fd == -1 || write( fd, spool, SPOOL_LEN ) != SPOOL_LEN )
+            fail( "writing the spool" );
+      close( fd );
+
+      static char left[ SPOOL_LEN + 1 ];
+      NntmSendStats st;
+
+      /* reads nothing: all of it is still to send */
+      size_t n = run( 0, left, &st );
+      if ( n != SPOOL_LEN || memcmp( left, spool, n ) || st.lines )
+            fail( "lines not read by the daemon taken out of the spool" );
+
+      /* reads 128 KiB: a tail is left, cut within what was read */
+      n          = run( TAKE_BYTES, left, &st );
+      size_t cut = SPOOL_LEN - n;
+      if ( !cut )
+            fail( "nothing the daemon read taken out of the spool" );
+      if ( cut % LINE_LEN || memcmp( left, spool + cut, n ) )
+            fail( "spool is not a tail of what it held" );
+      if ( cut > taken - taken % LINE_LEN )
+            fail( "spool cut beyond the lines the daemon read" );
+      if ( cut != st.bytes )
+            fail( "spool cut elsewhere than after the lines counted sent" );
+      printf( "test_nntm_send: %zu of %d bytes read, %zu taken out\n", taken,
+              SPOOL_LEN, cut );
+
+      /* reads everything: the rest arrives, once */
+      size_t rest = n;
+      n           = run( SIZE_MAX, left, &st );
+      if ( n || taken != rest || memcmp( got, spool + cut, rest ) ||
+           st.bytes != rest || st.replayed != rest / LINE_LEN )
+            fail( "the rest of the spool did not arrive as it was" );
+
+      unlink( spool_path );
+      printf( "test_nntm_send: ok\n" );
+      return 0;
+}
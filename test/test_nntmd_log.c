@@ -0,0 +1,185 @@
+/* test_nntmd_log – READER since=<seq> against hand-made -d logs
+ *
+ *   test_nntmd_log <nntmd>
+ *
+ * Writes log files, starts the daemon on each with -d -T and asks for a
+ * record in it:
+ *   - one whose "<seq>:<ns>\t" header is cut by the 64 KiB read that
+ *     log_find() scans with: it must come back first, not the one after;
+ *   - with types=, records of -L bytes of line behind a 41 byte header:
+ *     each must come back whole, with its number.
+ * Exits 0 when they do.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FIRST_SEQ 1000000ull
+#define SCAN_SIZE ( 64 * 1024 ) /* nntmd's BUF_SIZE */
+#define CUT_AT 26 /* header bytes before the scan boundary; the header is 28 */
+#define BIG_SEQ 10000000000000000000ull /* 20 digits: a 41 byte header */
+#define BIG_HDR 41
+#define LINE_LIMIT 96
+#define BIG_RECORDS 3
+
+static char dir[ 64 ], sock_path[ 108 ];
+static const char *nntmd;
+static pid_t dpid;
+static char log[ 2 * SCAN_SIZE ];
+
+static void stop( void )
+{
+      if ( dpid > 0 )
+      {
+            kill( dpid, SIGKILL );
+            waitpid( dpid, NULL, 0 );
+      }
+      dpid = 0;
+}
+
+static void cleanup( void )
+{
+      char cmd[ 128 ];
+      stop();
+      snprintf( cmd, sizeof cmd, "rm -rf %s", dir );
+      system( cmd );
+}
+
+static void fail( const char *msg )
+{
+      fprintf( stderr, "test_nntmd_log: %s\n", msg );
+      cleanup();
+      exit( 1 );
+}
+
+/* "<seq>:<ns>\t", then x's up to `len` bytes in all, ending " @x\n" */
+static size_t record( char *dst, unsigned long long seq, size_t len )
+{
+      int n = sprintf( dst, "%llu:%019llu\t", seq, 1700000000000000000ull );
+      memset( dst + n, 'x', len - (size_t)n );
+      memcpy( dst + len - 4, " @x\n", 4 );
+      return len;
+}
+
+/* Writes the first `len` bytes of log as the file of first_seq in a fresh
+ * log directory, starts the daemon on it (with -L line_limit) and sends
+ * `hello`; returns the connection. */
+static int start( unsigned long long first_seq, size_t len, int line_limit,
+                  const char *hello )
+{
+      char path[ 128 ], logdir[ 96 ], limit[ 16 ];
+      stop();
+      snprintf( path, sizeof path, "rm -rf %s/log", dir );
+      system( path );
+      snprintf( logdir, sizeof logdir, "%s/log", dir );
+      mkdir( logdir, 0700 );
+      snprintf( path, sizeof path, "%s/%020llu.log", logdir, first_seq );
+      int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+      if ( fd == -1 || write( fd, log, len ) != (ssize_t)len )
+            fail( "writing the log" );
+      close( fd );
+
+      unlink( sock_path );
+      snprintf( limit, sizeof limit, "%d", line_limit );
+      dpid = fork();
+      if ( dpid == 0 )
+      {
+            execl( nntmd, nntmd, "-p", sock_path, "-d", logdir, "-T", "-L",
+                   limit, (char *)NULL );
+            _exit( 127 );
+      }
+      struct stat st;
+      for ( int i = 0; i < 500 && stat( sock_path, &st ) == -1; ++i )
+            usleep( 10000 );
+
+      fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+      struct sockaddr_un sa = { .sun_family = AF_UNIX };
+      snprintf( sa.sun_path, sizeof sa.sun_path, "%s", sock_path );
+      if ( connect( fd, (struct sockaddr *)&sa, sizeof sa ) == -1 )
+            fail( "daemon did not come up" );
+      if ( write( fd, hello, strlen( hello ) ) != (ssize_t)strlen( hello ) )
+            fail( "handshake" );
+      struct timeval tv = { 2, 0 };
+      setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv );
+      return fd;
+}
+
+/* Reads until `lines` lines are in (the OK line first) or nothing more
+ * comes; returns how many bytes. */
+static size_t receive( int fd, char *buf, size_t size, int lines )
+{
+      size_t got = 0;
+      int nls    = 0;
+      while ( got < size - 1 && nls < lines )
+      {
+            ssize_t r = read( fd, buf + got, size - 1 - got );
+            if ( r <= 0 )
+                  break;
+            for ( ssize_t k = 0; k < r; ++k )
+                  nls += buf[ got + (size_t)k ] == '\n';
+            got += (size_t)r;
+      }
+      buf[ got ] = '\0';
+      close( fd );
+      if ( strncmp( buf, "OK", 2 ) )
+            fail( "no OK from the daemon" );
+      return got;
+}
+
+int main( int argc, char **argv )
+{
+      if ( argc != 2 )
+      {
+            fprintf( stderr, "usage: %s <nntmd>\n", argv[ 0 ] );
+            return 1;
+      }
+      nntmd = argv[ 1 ];
+      snprintf( dir, sizeof dir, "/tmp/test_nntmd_log.%d", (int)getpid() );
+      snprintf( sock_path, sizeof sock_path, "%s/sock", dir );
+      if ( mkdir( dir, 0700 ) == -1 )
+            fail( "mkdir" );
+
+      /* record FIRST_SEQ + 1 starts CUT_AT bytes before the boundary */
+      size_t len = record( log, FIRST_SEQ, SCAN_SIZE - CUT_AT );
+      for ( unsigned long long s = FIRST_SEQ + 1; s < FIRST_SEQ + 4; ++s )
+            len += record( log + len, s, 100 );
+      char hello[ 96 ], buf[ 4096 ];
+      snprintf( hello, sizeof hello, "READER since=%llu\n", FIRST_SEQ + 1 );
+      receive( start( FIRST_SEQ, len, SCAN_SIZE, hello ), buf, sizeof buf, 2 );
+      unsigned long long seq = strtoull( strchr( buf, '\n' ) + 1, NULL, 10 );
+      if ( seq != FIRST_SEQ + 1 )
+      {
+            fprintf( stderr, "test_nntmd_log: since=%llu began at %llu\n",
+                     FIRST_SEQ + 1, seq );
+            fail( "record skipped" );
+      }
+
+      /* records as long as -L allows, behind the longest headers */
+      len = 0;
+      for ( int i = 0; i < BIG_RECORDS; ++i )
+            len += record( log + len, BIG_SEQ + (unsigned long long)i,
+                           BIG_HDR + LINE_LIMIT );
+      snprintf( hello, sizeof hello, "READER since=%llu types=x\n", BIG_SEQ );
+      size_t got = receive( start( BIG_SEQ, len, LINE_LIMIT, hello ), buf,
+                            sizeof buf, 1 + BIG_RECORDS );
+      const char *p = strchr( buf, '\n' ) + 1;
+      if ( (size_t)( buf + got - p ) != len || memcmp( p, log, len ) )
+      {
+            fprintf( stderr, "test_nntmd_log: types=x got\n%s", p );
+            fail( "records not sent whole" );
+      }
+
+      cleanup();
+      printf( "test_nntmd_log: ok\n" );
+      return 0;
+}